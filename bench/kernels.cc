@@ -0,0 +1,425 @@
+// Micro-benchmarks for the ray/primitive intersection kernels.
+//
+// Every kernel runs over the same randomized (fixed seed) set of rays and
+// primitives. Results are printed as CSV lines so runs can be stored and
+// compared across commits:
+//
+//   bench_kernels [--count N] [--csv out.csv] [--baseline ref.csv] [--tolerance 0.1]
+//
+// The sphere_* kernels test each ray against the batch of SPHERE_BATCH
+// spheres holding its target, and only report the closest: their hit rate
+// is per ray over the batch size. sphere_packet tests SIMD_WIDTH rays at a
+// time against the batch of the first one. tri_soa and tri_simd do the same
+// as sphere_soa and sphere_simd over TRI_BATCH triangles.
+//
+// The mesh_* kernels trace each ray through a scene of MESH_GRID^2
+// icospheres of 20480 triangles, along its binary, wide or quantized
+// hierarchy: their time is per ray. mesh_lbvh_wide traces the wide layout of
+// the faster built LBVH.
+
+#include <chrono>
+#include <limits>
+#include <fstream>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "raytracing.hh"
+#include "renderer.hh"
+#include "scenes.hh"
+#include "vectors.hh"
+
+using namespace RE;
+
+namespace
+{
+    const uint32_t DATASET_SIZE = 1 << 16;
+    const uint64_t DEFAULT_COUNT = 1 << 22;
+    const uint32_t SPHERE_BATCH = 256;
+    const uint32_t TRI_BATCH = 256;
+    const uint32_t MESH_GRID = 3;
+
+    struct triangle {
+        vec3_t a, b, c;
+    };
+
+    struct plane {
+        vec3_t point, normal;
+    };
+
+    struct sphere {
+        vec3_t center;
+        float radius;
+    };
+
+    struct bench_data {
+        std::vector<ray_t> rays;
+        std::vector<sphere> spheres;
+        std::vector<plane> planes;
+        std::vector<triangle> tris;
+
+        std::vector<geometry_spheres_t> sphere_batches;
+        std::vector<geometry_triangles_t> tri_batches;
+        std::vector<ray_packet_t> packets;
+
+        scene_t *meshes;
+    };
+
+    struct bench_result {
+        std::string name;
+        double ns_per_test;
+        double hit_rate;
+    };
+
+    // Returns the number of hits over `count` ray/primitive tests
+    typedef uint64_t (*kernel_fn)(const bench_data& d, uint64_t count);
+
+    struct bench_kernel {
+        const char *name;
+        kernel_fn run;
+    };
+
+    // Pairs ray i with primitive (i * 7) so the same ray does not always
+    // meet the same primitive.
+    inline uint32_t prim_index(uint64_t i)
+    {
+        return (i * 7) & (DATASET_SIZE - 1);
+    }
+
+    // Primitives share their centers, and each ray aims near the center of
+    // the primitive it will be tested against: every kernel sees a mix of
+    // hits and misses.
+    bench_data generate_data(uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> outer(-10.f, 10.f);
+        std::uniform_real_distribution<float> inner(-2.f, 2.f);
+        std::uniform_real_distribution<float> unit(-1.f, 1.f);
+        std::uniform_real_distribution<float> radius(0.2f, 1.f);
+
+        bench_data d;
+        std::vector<vec3_t> centers;
+        for (uint32_t i = 0; i < DATASET_SIZE; i++) {
+            vec3_t c(inner(rng), inner(rng), inner(rng));
+            centers.push_back(c);
+
+            d.spheres.push_back({ c, radius(rng) });
+
+            vec3_t n = normalize(vec3_t(unit(rng), unit(rng), unit(rng)));
+            d.planes.push_back({ c, n });
+
+            d.tris.push_back({
+                c + vec3_t(unit(rng), unit(rng), unit(rng)),
+                c + vec3_t(unit(rng), unit(rng), unit(rng)),
+                c + vec3_t(unit(rng), unit(rng), unit(rng)),
+            });
+        }
+
+        for (uint32_t i = 0; i < DATASET_SIZE; i++) {
+            vec3_t origin(outer(rng), outer(rng), outer(rng));
+            vec3_t target = centers[prim_index(i)] + vec3_t(unit(rng), unit(rng), unit(rng));
+            d.rays.push_back({ origin, normalize(target - origin) });
+        }
+
+        for (uint32_t b = 0; b < DATASET_SIZE; b += SPHERE_BATCH) {
+            geometry_spheres_t g;
+            for (uint32_t i = 0; i < SPHERE_BATCH; i++)
+                spheres_push(g, d.spheres[b + i].center, d.spheres[b + i].radius, i);
+            spheres_pad(g);
+            d.sphere_batches.push_back(g);
+        }
+
+        for (uint32_t b = 0; b < DATASET_SIZE; b += TRI_BATCH) {
+            geometry_triangles_t g;
+            for (uint32_t i = 0; i < TRI_BATCH; i++) {
+                const triangle& t = d.tris[b + i];
+                triangles_push(g, t.a, t.b, t.c, i, i * 3);
+            }
+            d.tri_batches.push_back(g);
+        }
+
+        // Spread over the region the rays aim at
+        d.meshes = new scene_t();
+        for (uint32_t z = 0; z < MESH_GRID; z++) {
+            for (uint32_t x = 0; x < MESH_GRID; x++) {
+                vec3_t c(x * 1.5f - 1.5f, 0.f, z * 1.5f - 1.5f);
+                d.meshes->objects.push_back(create_icosphere(c, 0.6f, 5, material_t()));
+            }
+        }
+        build_scene_geometry(d.meshes, 1);
+
+        for (uint32_t i = 0; i < DATASET_SIZE; i += SIMD_WIDTH) {
+            ray_packet_t p;
+            for (uint32_t l = 0; l < SIMD_WIDTH; l++) {
+                const ray_t& r = d.rays[i + l];
+                p.ox[l] = r.origin.x;
+                p.oy[l] = r.origin.y;
+                p.oz[l] = r.origin.z;
+                p.dx[l] = r.direction.x;
+                p.dy[l] = r.direction.y;
+                p.dz[l] = r.direction.z;
+            }
+            d.packets.push_back(p);
+        }
+
+        return d;
+    }
+
+    uint64_t run_sphere(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            hit_t hit;
+            const sphere& s = d.spheres[prim_index(i)];
+            hits += intersect_sphere(d.rays[i & (DATASET_SIZE - 1)], s.center, s.radius, &hit);
+        }
+        return hits;
+    }
+
+    uint64_t run_plane(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            hit_t hit;
+            const plane& p = d.planes[prim_index(i)];
+            hits += intersect_plane(d.rays[i & (DATASET_SIZE - 1)], p.point, p.normal, &hit);
+        }
+        return hits;
+    }
+
+    uint64_t run_tri(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            hit_t hit;
+            const triangle& t = d.tris[prim_index(i)];
+            hits += intersect_tri(d.rays[i & (DATASET_SIZE - 1)], t.a, t.b, t.c, &hit);
+        }
+        return hits;
+    }
+
+    const geometry_spheres_t& sphere_batch(const bench_data& d, uint64_t ray)
+    {
+        return d.sphere_batches[prim_index(ray) / SPHERE_BATCH];
+    }
+
+    uint64_t run_sphere_soa(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count / SPHERE_BATCH; i++) {
+            float t = std::numeric_limits<float>::infinity();
+            uint64_t r = i & (DATASET_SIZE - 1);
+            hits += intersect_spheres(sphere_batch(d, r), d.rays[r], &t) != NO_PRIMITIVE;
+        }
+        return hits;
+    }
+
+    uint64_t run_sphere_simd(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count / SPHERE_BATCH; i++) {
+            float t = std::numeric_limits<float>::infinity();
+            uint64_t r = i & (DATASET_SIZE - 1);
+            hits += intersect_spheres_simd(sphere_batch(d, r), d.rays[r], &t) != NO_PRIMITIVE;
+        }
+        return hits;
+    }
+
+    uint64_t run_sphere_packet(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count / (SPHERE_BATCH * SIMD_WIDTH); i++) {
+            float t[SIMD_WIDTH];
+            uint32_t index[SIMD_WIDTH];
+            for (uint32_t l = 0; l < SIMD_WIDTH; l++) {
+                t[l] = std::numeric_limits<float>::infinity();
+                index[l] = NO_PRIMITIVE;
+            }
+
+            uint64_t p = i % d.packets.size();
+            intersect_spheres_packet(sphere_batch(d, p * SIMD_WIDTH), d.packets[p], t, index);
+            for (uint32_t l = 0; l < SIMD_WIDTH; l++)
+                hits += index[l] != NO_PRIMITIVE;
+        }
+        return hits;
+    }
+
+    uint64_t run_tri_soa(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count / TRI_BATCH; i++) {
+            float t = std::numeric_limits<float>::infinity();
+            vec3_t barycentric;
+            uint64_t r = i & (DATASET_SIZE - 1);
+            const geometry_triangles_t& g = d.tri_batches[prim_index(r) / TRI_BATCH];
+            hits += intersect_triangles(g, d.rays[r], false, &t, &barycentric) != NO_PRIMITIVE;
+        }
+        return hits;
+    }
+
+    uint64_t run_tri_simd(const bench_data& d, uint64_t count)
+    {
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count / TRI_BATCH; i++) {
+            float t = std::numeric_limits<float>::infinity();
+            vec3_t barycentric;
+            uint64_t r = i & (DATASET_SIZE - 1);
+            const geometry_triangles_t& g = d.tri_batches[prim_index(r) / TRI_BATCH];
+            hits += intersect_triangles_simd(g, d.rays[r], false, &t, &barycentric) != NO_PRIMITIVE;
+        }
+        return hits;
+    }
+
+    uint64_t run_mesh(const bench_data& d, uint64_t count, bvh_layout_e layout,
+                      bvh_builder_e builder)
+    {
+        // Rebuilt in the warm-up pass
+        scene_geometry_t& g = d.meshes->geometry;
+        if (g.layout != layout || g.builder != builder) {
+            g.layout = layout;
+            g.builder = builder;
+            build_scene_geometry(d.meshes, 1);
+        }
+
+        uint64_t hits = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            hit_t hit;
+            hits += intersect_scene(d.meshes, d.rays[i & (DATASET_SIZE - 1)], &hit, RAY_PRIMARY);
+        }
+        return hits;
+    }
+
+    uint64_t run_mesh_bvh2(const bench_data& d, uint64_t count)
+    {
+        return run_mesh(d, count, BVH_BINARY, BVH_BUILD_SAH);
+    }
+
+    uint64_t run_mesh_bvh_wide(const bench_data& d, uint64_t count)
+    {
+        return run_mesh(d, count, BVH_WIDE, BVH_BUILD_SAH);
+    }
+
+    uint64_t run_mesh_bvh_quantized(const bench_data& d, uint64_t count)
+    {
+        return run_mesh(d, count, BVH_QUANTIZED, BVH_BUILD_SAH);
+    }
+
+    uint64_t run_mesh_lbvh_wide(const bench_data& d, uint64_t count)
+    {
+        return run_mesh(d, count, BVH_WIDE, BVH_BUILD_LBVH);
+    }
+
+    const bench_kernel kernels[] = {
+        { "sphere", run_sphere },
+        { "sphere_soa", run_sphere_soa },
+        { "sphere_simd", run_sphere_simd },
+        { "sphere_packet", run_sphere_packet },
+        { "plane", run_plane },
+        { "tri", run_tri },
+        { "tri_soa", run_tri_soa },
+        { "tri_simd", run_tri_simd },
+        { "mesh_bvh2", run_mesh_bvh2 },
+        { "mesh_bvh_wide", run_mesh_bvh_wide },
+        { "mesh_bvh_quantized", run_mesh_bvh_quantized },
+        { "mesh_lbvh_wide", run_mesh_lbvh_wide },
+    };
+
+    bench_result run_kernel(const bench_kernel& k, const bench_data& d, uint64_t count)
+    {
+        // Warm-up pass, also pulls the dataset in cache
+        k.run(d, DATASET_SIZE);
+
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t hits = k.run(d, count);
+        auto t1 = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double, std::nano> ns = t1 - t0;
+        return { k.name, ns.count() / count, (double)hits / count };
+    }
+
+    std::map<std::string, double> load_baseline(const char *path)
+    {
+        std::map<std::string, double> res;
+        std::ifstream in(path);
+        std::string line;
+
+        if (!in) {
+            fprintf(stderr, "Unable to read baseline %s\n", path);
+            return res;
+        }
+
+        while (std::getline(in, line)) {
+            char name[128];
+            double ns, rate;
+            if (sscanf(line.c_str(), "%127[^,],%lf,%lf", name, &ns, &rate) == 3)
+                res[name] = ns;
+        }
+        return res;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t count = DEFAULT_COUNT;
+    const char *csv_path = nullptr;
+    const char *baseline_path = nullptr;
+    double tolerance = 0.1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--count") && i + 1 < argc)
+            count = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--count N] [--csv out.csv] "
+                            "[--baseline ref.csv] [--tolerance 0.1]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_data data = generate_data(1);
+    std::vector<bench_result> results;
+
+    for (const bench_kernel& k : kernels)
+        results.push_back(run_kernel(k, data, count));
+    destroy_scene(data.meshes);
+    delete data.meshes;
+
+    printf("kernel,ns_per_test,hit_rate\n");
+    for (const bench_result& r : results)
+        printf("%s,%.3f,%.4f\n", r.name.c_str(), r.ns_per_test, r.hit_rate);
+
+    if (csv_path) {
+        std::ofstream out(csv_path);
+        out << "kernel,ns_per_test,hit_rate\n";
+        for (const bench_result& r : results)
+            out << r.name << "," << r.ns_per_test << "," << r.hit_rate << "\n";
+    }
+
+    if (!baseline_path)
+        return 0;
+
+    int regressions = 0;
+    std::map<std::string, double> baseline = load_baseline(baseline_path);
+    for (const bench_result& r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end())
+            continue;
+
+        double delta = (r.ns_per_test - it->second) / it->second;
+        bool slower = delta > tolerance;
+        printf("%-16s %8.3f ns -> %8.3f ns (%+.1f%%)%s\n", r.name.c_str(), it->second,
+               r.ns_per_test, delta * 100.0, slower ? " REGRESSION" : "");
+        regressions += slower;
+    }
+
+    return regressions ? 2 : 0;
+}
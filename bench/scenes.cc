@@ -0,0 +1,274 @@
+// End-to-end regression benchmark.
+//
+// Renders every canonical scene with every integrator, headless, at a fixed
+// seed and sample count. Each render is timed and compared against the
+// reference image stored in bench/references; a render whose PSNR falls under
+// the integrator threshold is reported as a failure.
+//
+//   bench_scenes [--scene name] [--integrator name] [--width N] [--height N]
+//                [--samples N] [--threads N] [--seed N] [--block N]
+//                [--references dir] [--update] [--denoise] [--aovs dir]
+//                [--filter box|tent|gaussian|mitchell] [--bvh binary|wide|quantized]
+//                [--builder sah|lbvh]
+//
+// --block sets the size of the pixel blocks averaged before comparing.
+// --samples is the pass count for the photon mapper and the mutations per
+// pixel for MLT. --denoise filters the renders before comparing them.
+// --aovs writes every output variable as <dir>/<scene>-<integrator>-<name>.pfm
+// --filter overrides PIXEL_FILTER; the references are rendered with it.
+// --bvh picks the hierarchy layout traced, wide by default, and --builder
+// how it is built: binned SAH by default, LBVH for a faster build. The build
+// time of the scene geometry is reported apart from the render time.
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "defines.hh"
+#include "framework.hh"
+#include "lodepng.hh"
+#include "scenes.hh"
+
+using namespace RE;
+
+namespace
+{
+    struct bench_scene {
+        const char *name;
+        void (*build)(scene_t *scene);
+    };
+
+    struct bench_integrator {
+        const char *name;
+        integrator_e integrator;
+        float min_psnr;
+    };
+
+    const bench_scene scenes[] = {
+        { "cornell", scene_cornell_box },
+        { "spheres", scene_many_spheres },
+        { "mesh", scene_high_poly_mesh },
+        { "lights", scene_many_lights },
+        { "indirect", scene_indirect },
+    };
+
+    // Thresholds leave room for noise: an unbiased change of the sampling
+    // must pass, a bias or a broken integrator must not.
+    const bench_integrator integrators[] = {
+        { "raytracer", integrator_e::RAYTRACER, 40.f },
+        { "pathtracer", integrator_e::PATHTRACER, 22.f },
+        { "bdpt", integrator_e::BIDIR_PATHTRACER, 22.f },
+        { "mdt", integrator_e::MDT, 18.f },
+        { "photon", integrator_e::PHOTON_MAPPER, 22.f },
+        { "mlt", integrator_e::MLT, 18.f },
+    };
+
+    struct image_diff {
+        double rmse;
+        double psnr;
+    };
+
+    // Metrics are computed on block averages: the references are noisy too,
+    // so a per-pixel comparison would only measure the noise.
+    image_diff compare(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b,
+                       uint32_t width, uint32_t height, uint32_t block)
+    {
+        double sum = 0.0;
+        uint64_t n = 0;
+
+        for (uint32_t by = 0; by < height; by += block) {
+            for (uint32_t bx = 0; bx < width; bx += block) {
+                for (uint32_t c = 0; c < 3; c++) {
+                    double da = 0.0, db = 0.0;
+                    uint32_t count = 0;
+
+                    for (uint32_t y = by; y < std::min(height, by + block); y++) {
+                        for (uint32_t x = bx; x < std::min(width, bx + block); x++) {
+                            da += a[(x + y * width) * STRIDE + c];
+                            db += b[(x + y * width) * STRIDE + c];
+                            count++;
+                        }
+                    }
+
+                    double d = (da - db) / (count * 255.0);
+                    sum += d * d;
+                    n++;
+                }
+            }
+        }
+
+        double rmse = sqrt(sum / n);
+        double psnr = rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY;
+        return { rmse, psnr };
+    }
+
+    bool filter_from_name(const char *name, pixel_filter_e *out)
+    {
+        const char *names[] = { "box", "tent", "gaussian", "mitchell" };
+        for (uint32_t f = 0; f < 4; f++) {
+            if (!strcmp(name, names[f])) {
+                *out = (pixel_filter_e)f;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool match(const char *filter, const char *name)
+    {
+        return !filter || !strcmp(filter, name);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *scene_filter = nullptr;
+    const char *integrator_filter = nullptr;
+    std::string references = BENCH_REFERENCE_DIR;
+    uint32_t width = 64;
+    uint32_t height = 64;
+    uint32_t samples = 16;
+    uint32_t threads = MAX_THREADS;
+    uint64_t seed = 1;
+    uint32_t block = 8;
+    bool update = false;
+    bool denoise = false;
+    const char *aovs = nullptr;
+    pixel_filter_e filter = PIXEL_FILTER;
+    bvh_layout_e layout = BVH_WIDE;
+    bvh_builder_e builder = BVH_BUILD_SAH;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+            scene_filter = argv[++i];
+        else if (!strcmp(argv[i], "--integrator") && i + 1 < argc)
+            integrator_filter = argv[++i];
+        else if (!strcmp(argv[i], "--width") && i + 1 < argc)
+            width = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--height") && i + 1 < argc)
+            height = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--samples") && i + 1 < argc)
+            samples = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--block") && i + 1 < argc)
+            block = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--references") && i + 1 < argc)
+            references = argv[++i];
+        else if (!strcmp(argv[i], "--update"))
+            update = true;
+        else if (!strcmp(argv[i], "--denoise"))
+            denoise = true;
+        else if (!strcmp(argv[i], "--aovs") && i + 1 < argc)
+            aovs = argv[++i];
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc && filter_from_name(argv[i + 1], &filter))
+            i++;
+        else if (!strcmp(argv[i], "--bvh") && i + 1 < argc && !strcmp(argv[i + 1], "binary")) {
+            layout = BVH_BINARY;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--bvh") && i + 1 < argc && !strcmp(argv[i + 1], "wide"))
+            i++;
+        else if (!strcmp(argv[i], "--bvh") && i + 1 < argc && !strcmp(argv[i + 1], "quantized")) {
+            layout = BVH_QUANTIZED;
+            i++;
+        }
+        else if (!strcmp(argv[i], "--builder") && i + 1 < argc && !strcmp(argv[i + 1], "sah"))
+            i++;
+        else if (!strcmp(argv[i], "--builder") && i + 1 < argc && !strcmp(argv[i + 1], "lbvh")) {
+            builder = BVH_BUILD_LBVH;
+            i++;
+        }
+        else {
+            fprintf(stderr, "usage: %s [--scene name] [--integrator name] [--width N] "
+                            "[--height N] [--samples N] [--threads N] [--seed N] "
+                            "[--block N] [--references dir] [--update] [--denoise] "
+                            "[--aovs dir] [--filter box|tent|gaussian|mitchell] "
+                            "[--bvh binary|wide|quantized] [--builder sah|lbvh]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<std::string> results;
+    uint32_t failures = 0;
+
+    for (const bench_scene& s : scenes) {
+        if (!match(scene_filter, s.name))
+            continue;
+
+        for (const bench_integrator& it : integrators) {
+            if (!match(integrator_filter, it.name))
+                continue;
+
+            scene_t scene = scene_t();
+            s.build(&scene);
+            scene.geometry.layout = layout;
+            scene.geometry.builder = builder;
+
+            std::vector<uint8_t> frame(width * height * STRIDE, 0);
+            struct renderer_info info;
+            memset(&info, 0, sizeof(info));
+            info.width = width;
+            info.height = height;
+            info.output_frame = frame.data();
+            info.scene = &scene;
+            info.integrator = it.integrator;
+            info.samples = samples;
+            info.thread_count = threads;
+            info.seed = seed;
+            info.denoise = denoise;
+            info.filter = filter;
+            aov_film_t aov_film;
+            info.aovs = aovs ? AOV_ALL : 0;
+            info.aov_film = &aov_film;
+
+            printf("== %s / %s\n", s.name, it.name);
+            float time = render_frame(info, nullptr);
+            float build = scene.geometry.build_time;
+            destroy_scene(&scene);
+            if (aovs)
+                aov_save(aov_film, (std::string(aovs) + "/" + s.name + "-" + it.name).c_str());
+
+            std::string path = references + "/" + s.name + "-" + it.name + ".png";
+            char line[256];
+
+            if (update) {
+                bool written = !lodepng::encode(path, frame, width, height);
+                snprintf(line, sizeof(line), "%s,%s,%.4f,%.3f,,,%s", s.name, it.name,
+                         build, time, written ? "updated" : "write error");
+                failures += !written;
+                results.push_back(line);
+                continue;
+            }
+
+            std::vector<uint8_t> ref;
+            unsigned ref_w, ref_h;
+            if (lodepng::decode(ref, ref_w, ref_h, path) || ref_w != width || ref_h != height) {
+                snprintf(line, sizeof(line), "%s,%s,%.4f,%.3f,,,missing", s.name, it.name,
+                         build, time);
+                results.push_back(line);
+                failures++;
+                continue;
+            }
+
+            image_diff d = compare(frame, ref, width, height, block);
+            bool ok = d.psnr >= it.min_psnr;
+            snprintf(line, sizeof(line), "%s,%s,%.4f,%.3f,%.5f,%.2f,%s", s.name, it.name,
+                     build, time, d.rmse, d.psnr, ok ? "ok" : "FAIL");
+            results.push_back(line);
+            failures += !ok;
+        }
+    }
+
+    printf("\nscene,integrator,build,time,rmse,psnr,status\n");
+    for (const std::string& l : results)
+        puts(l.c_str());
+
+    return failures ? 2 : 0;
+}
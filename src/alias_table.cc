@@ -0,0 +1,50 @@
+#include <algorithm>
+
+#include "alias_table.hh"
+
+namespace RE
+{
+    // Vose's construction: entries under the mean are topped up with the
+    // excess of entries over it.
+    void alias_table_build(alias_table_t& t, const std::vector<float>& weights)
+    {
+        uint32_t n = weights.size();
+        double sum = 0.0;
+        for (float w : weights)
+            sum += w;
+
+        t.threshold.assign(n, 1.f);
+        t.alias.resize(n);
+        t.pdf.resize(n);
+
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (uint32_t i = 0; i < n; i++) {
+            t.alias[i] = i;
+            t.pdf[i] = sum > 0.0 ? weights[i] / sum : 1.0 / n;
+            scaled[i] = t.pdf[i] * n;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            uint32_t s = small.back();
+            uint32_t l = large.back();
+            small.pop_back();
+            large.pop_back();
+
+            t.threshold[s] = scaled[s];
+            t.alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            (scaled[l] < 1.0 ? small : large).push_back(l);
+        }
+        // Leftovers are only there through rounding: they keep their slot
+    }
+
+    uint32_t alias_table_sample(const alias_table_t& t, float u)
+    {
+        uint32_t n = t.threshold.size();
+        float x = u * n;
+        uint32_t i = std::min<uint32_t>(x, n - 1);
+        return x - i < t.threshold[i] ? i : t.alias[i];
+    }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace RE
+{
+    // Walker's alias method: draws from a discrete distribution in O(1)
+    typedef struct alias_table {
+        std::vector<float> threshold;
+        std::vector<uint32_t> alias;
+        std::vector<float> pdf;
+    } alias_table_t;
+
+    // Weights do not need to be normalized. If they are all zero, the
+    // entries are drawn uniformly.
+    void alias_table_build(alias_table_t& t, const std::vector<float>& weights);
+
+    // Returns an index drawn from a single uniform number in [0, 1)
+    uint32_t alias_table_sample(const alias_table_t& t, float u);
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "aov.hh"
+#include "mapping.hh"
+#include "renderer.hh"
+
+namespace RE
+{
+    static const char *names[AOV_COUNT] = {
+        "depth", "normal", "albedo", "object_id", "uv", "direct", "indirect", "samples"
+    };
+
+    const char *aov_name(aov_e aov)
+    {
+        return names[aov];
+    }
+
+    uint32_t aov_components(aov_e aov)
+    {
+        switch (aov) {
+            case AOV_NORMAL:
+            case AOV_ALBEDO:
+            case AOV_UV:
+            case AOV_DIRECT:
+            case AOV_INDIRECT:
+                return 3;
+            default:
+                return 1;
+        }
+    }
+
+    void aov_film_init(aov_film_t& f, uint32_t width, uint32_t height, uint32_t mask)
+    {
+        f.width = width;
+        f.height = height;
+        for (uint32_t a = 0; a < AOV_COUNT; a++) {
+            uint32_t size = mask & aov_bit((aov_e)a) ? width * height * aov_components((aov_e)a) : 0;
+            f.channels[a].assign(size, 0.f);
+        }
+    }
+
+    void aov_write(aov_film_t& f, aov_e aov, uint32_t x, uint32_t y, vec3_t v)
+    {
+        std::vector<float>& c = f.channels[aov];
+        if (c.empty())
+            return;
+
+        uint32_t n = aov_components(aov);
+        float *out = &c[(x + y * f.width) * n];
+        for (uint32_t k = 0; k < n; k++)
+            out[k] = v[k];
+    }
+
+    vec3_t aov_read(const aov_film_t& f, aov_e aov, uint32_t x, uint32_t y)
+    {
+        const std::vector<float>& c = f.channels[aov];
+        if (c.empty())
+            return BLACK;
+
+        uint32_t n = aov_components(aov);
+        const float *in = &c[(x + y * f.width) * n];
+        return n == 3 ? vec3_t(in[0], in[1], in[2]) : vec3_t(in[0], 0.f, 0.f);
+    }
+
+    // Portable float map: a text header, then rows of little endian floats
+    // from the bottom of the image up (the negative scale tells the order).
+    void aov_save(const aov_film_t& f, const char *prefix)
+    {
+        for (uint32_t a = 0; a < AOV_COUNT; a++) {
+            const std::vector<float>& c = f.channels[a];
+            if (c.empty())
+                continue;
+
+            std::string path = std::string(prefix) + "-" + names[a] + ".pfm";
+            FILE *out = fopen(path.c_str(), "wb");
+            if (!out) {
+                fprintf(stderr, "Unable to write %s\n", path.c_str());
+                continue;
+            }
+
+            uint32_t n = aov_components((aov_e)a);
+            fprintf(out, "%s\n%u %u\n-1.0\n", n == 3 ? "PF" : "Pf", f.width, f.height);
+            for (uint32_t y = f.height; y-- > 0;)
+                fwrite(&c[y * f.width * n], sizeof(float), f.width * n, out);
+            fclose(out);
+            printf("AOV written to %s\n", path.c_str());
+        }
+    }
+
+    static void first_hit(struct renderer_info& i, uint32_t x, uint32_t y)
+    {
+        aov_film_t& f = *i.aov_film;
+        ray_t r = get_ray_from_camera(i, x, y);
+        hit_t hit;
+
+        if (!intersect_scene(i.scene, r, &hit, RAY_PRIMARY)) {
+            aov_write(f, AOV_OBJECT_ID, x, y, vec3_t(-1.f));
+            aov_write(f, AOV_ALBEDO, x, y, WHITE);
+            return;
+        }
+
+        // Planes and lights have no texture coordinates
+        bool mapped = hit.object->type == object_type_e::SPHERE
+                   || hit.object->type == object_type_e::MESH;
+        bool light = hit.object->type == object_type_e::AREA_LIGHT;
+
+        aov_write(f, AOV_DEPTH, x, y, vec3_t(magnitude(hit.position - r.origin)));
+        aov_write(f, AOV_NORMAL, x, y, dot(hit.normal, r.direction) < 0.f ? hit.normal : -hit.normal);
+        aov_write(f, AOV_ALBEDO, x, y, light ? WHITE : get_diffuse_color(i.scene, hit));
+        aov_write(f, AOV_OBJECT_ID, x, y, vec3_t(hit.object->id));
+        aov_write(f, AOV_UV, x, y, mapped ? hit.uv_coord : BLACK);
+    }
+
+    void aov_render_first_hit(struct renderer_info& i, struct area bounds)
+    {
+        parallel_rows(bounds.h, i.thread_count, [&](uint32_t r) {
+            for (uint32_t x = bounds.x; x < bounds.x + bounds.w; x++)
+                first_hit(i, x, bounds.y + r);
+        });
+    }
+}
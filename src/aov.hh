@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "types.hh"
+
+namespace RE
+{
+    // Arbitrary output variables, rendered along the color
+    typedef enum aov {
+        AOV_DEPTH, // Distance to the first hit
+        AOV_NORMAL, // World normal of the first hit, facing the camera
+        AOV_ALBEDO,
+        AOV_OBJECT_ID, // Index in scene_t::objects, -1 when nothing is hit
+        AOV_UV,
+        AOV_DIRECT, // Emission seen through at most one bounce
+        AOV_INDIRECT,
+        AOV_SAMPLES,
+        AOV_COUNT
+    } aov_e;
+
+    // Masks of channels, as in renderer_info::aovs
+    constexpr uint32_t aov_bit(aov_e aov)
+    {
+        return 1u << aov;
+    }
+
+    const uint32_t AOV_FIRST_HIT = aov_bit(AOV_DEPTH) | aov_bit(AOV_NORMAL) | aov_bit(AOV_ALBEDO)
+                                 | aov_bit(AOV_OBJECT_ID) | aov_bit(AOV_UV);
+    const uint32_t AOV_ALL = aov_bit(AOV_COUNT) - 1;
+
+    // Channels are only allocated when requested: the others stay empty,
+    // and writing to them does nothing.
+    typedef struct aov_film {
+        uint32_t width, height;
+        std::vector<float> channels[AOV_COUNT];
+    } aov_film_t;
+
+    const char *aov_name(aov_e aov);
+    // 1 for the scalar channels, 3 for the vectors
+    uint32_t aov_components(aov_e aov);
+
+    void aov_film_init(aov_film_t& f, uint32_t width, uint32_t height, uint32_t mask);
+
+    inline bool aov_enabled(const aov_film_t& f, aov_e aov)
+    {
+        return !f.channels[aov].empty();
+    }
+
+    // Scalar channels take v.x
+    void aov_write(aov_film_t& f, aov_e aov, uint32_t x, uint32_t y, vec3_t v);
+    vec3_t aov_read(const aov_film_t& f, aov_e aov, uint32_t x, uint32_t y);
+
+    // Writes <prefix>-<name>.pfm for each allocated channel
+    void aov_save(const aov_film_t& f, const char *prefix);
+}
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+#include "defines.hh"
+#include "helpers.hh"
+#include "mapping.hh"
+#include "renderer.hh"
+#include "stats.hh"
+
+// Bidirectional path tracer. Each sample traces a camera subpath and a light
+// subpath, then connects every pair of their vertices; the strategies are
+// combined with the power heuristic. Connections reaching the camera itself
+// (light tracing) are splatted to the pixel they project on.
+//
+// Densities follow the area measure: pdf_fwd is the density of a vertex when
+// sampled from its predecessor on its own subpath, pdf_rev the density it
+// would have if the path had been sampled from the other end.
+
+namespace RE
+{
+    typedef enum vertex_type {
+        VERTEX_CAMERA, VERTEX_LIGHT, VERTEX_SURFACE
+    } vertex_type_e;
+
+    typedef struct vertex {
+        vertex_type_e type;
+        vec3_t position;
+        vec3_t normal;
+        vec3_t albedo;
+        vec3_t beta;
+        area_light_t *light;
+        float pdf_fwd;
+        float pdf_rev;
+    } vertex_t;
+
+    typedef struct subpath {
+        vertex_t v[BDPT_MAX_DEPTH + 1];
+        uint32_t count;
+    } subpath_t;
+
+    // Solid angle density at `from` to area density at `to`
+    static float convert_density(const vertex_t& from, float pdf, const vertex_t& to)
+    {
+        vec3_t w = to.position - from.position;
+        float inv_dist2 = 1.f / dot(w, w);
+
+        // The pinhole has no surface to project on
+        if (to.type != VERTEX_CAMERA)
+            pdf *= fabs(dot(to.normal, w * sqrtf(inv_dist2)));
+        return pdf * inv_dist2;
+    }
+
+    // Lambertian BSDF, both directions pointing away from the surface
+    static vec3_t vertex_f(const vertex_t& v, vec3_t wo, vec3_t wi)
+    {
+        if (dot(v.normal, wo) * dot(v.normal, wi) <= 0.f)
+            return BLACK;
+        return v.albedo * (1.f / PI);
+    }
+
+    static float diffuse_pdf(const vertex_t& v, vec3_t wo, vec3_t wi)
+    {
+        float cos_i = dot(v.normal, wi);
+        if (dot(v.normal, wo) * cos_i <= 0.f)
+            return 0.f;
+        return fabs(cos_i) / PI;
+    }
+
+    // Area lights emit a cosine lobe on their front side
+    static float emission_pdf(const vertex_t& l, vec3_t w)
+    {
+        float cos_l = dot(l.normal, w);
+        return cos_l > 0.f ? cos_l / PI : 0.f;
+    }
+
+    static float light_origin_pdf(scene_t *scene, const vertex_t& l)
+    {
+        return pick_light_pdf(scene, l.light) / area_light_area(l.light);
+    }
+
+    // Area density of sampling `next` from `v`, `prev` being the vertex `v`
+    // was reached from.
+    static float vertex_pdf(struct renderer_info& i, const vertex_t& v, const vertex_t *prev,
+                            const vertex_t& next)
+    {
+        vec3_t wn = normalize(next.position - v.position);
+        float pdf = 0.f;
+
+        switch (v.type) {
+            case VERTEX_CAMERA:
+                pdf = get_camera_pdf(i, wn);
+                break;
+            case VERTEX_LIGHT:
+                pdf = emission_pdf(v, wn);
+                break;
+            case VERTEX_SURFACE:
+                pdf = diffuse_pdf(v, normalize(prev->position - v.position), wn);
+                break;
+        }
+        return convert_density(v, pdf, next);
+    }
+
+    // Extends `path` from its last vertex along `ray`. `scale` is the
+    // throughput carried by the ray and `pdf` its solid angle density.
+    static void random_walk(struct renderer_info& i, subpath_t& path, ray_t ray,
+                            vec3_t scale, float pdf, uint32_t max_count)
+    {
+        scene_t *scene = i.scene;
+        bool from_camera = path.v[0].type == VERTEX_CAMERA;
+        vec3_t mask = WHITE;
+
+        while (path.count < max_count) {
+            hit_t hit;
+            ray_kind_e kind = from_camera && path.count == 1 ? RAY_PRIMARY : RAY_BOUNCE;
+            if (!intersect_scene(scene, ray, &hit, kind))
+                break;
+
+            // Emitters are black: a light path ends there with nothing to add
+            bool emitter = hit.object->type == object_type_e::AREA_LIGHT;
+            if (emitter && !from_camera)
+                break;
+
+            vertex_t& prev = path.v[path.count - 1];
+            vertex_t& v = path.v[path.count++];
+            v.position = hit.position;
+            v.normal = hit.normal;
+            v.beta = scale * mask;
+            v.pdf_rev = 0.f;
+            if (emitter) {
+                v.type = VERTEX_LIGHT;
+                v.light = static_cast<area_light_t*>(hit.object);
+                v.albedo = BLACK;
+            }
+            else {
+                v.type = VERTEX_SURFACE;
+                v.light = nullptr;
+                v.albedo = get_diffuse_color(scene, hit);
+            }
+            v.pdf_fwd = convert_density(prev, pdf, v);
+
+            if (emitter || path.count >= max_count)
+                break;
+
+            vec3_t wo = -ray.direction;
+            vec3_t nl = dot(v.normal, wo) > 0.f ? v.normal : -v.normal;
+            ray.direction = get_cosine_hemisphere_random(nl);
+            ray.origin = v.position + nl * F_EPSYLON;
+            pdf = dot(ray.direction, nl) / PI;
+
+            // The diffuse lobe is symmetric: the reverse density is the
+            // cosine on the incoming side.
+            prev.pdf_rev = convert_density(v, dot(wo, nl) / PI, prev);
+
+            // (albedo / PI) * cos / pdf, with pdf = cos / PI
+            mask *= v.albedo;
+
+            if (path.count - 1 >= BDPT_RR_MIN_DEPTH && !russian_roulette(mask))
+                break;
+        }
+    }
+
+    static void camera_subpath(struct renderer_info& i, ray_t ray, subpath_t& path)
+    {
+        vertex_t& c = path.v[0];
+        c.type = VERTEX_CAMERA;
+        c.position = ray.origin;
+        c.normal = i.scene->camera.forward;
+        c.albedo = BLACK;
+        c.beta = WHITE;
+        c.light = nullptr;
+        c.pdf_fwd = 1.f;
+        c.pdf_rev = 0.f;
+        path.count = 1;
+
+        random_walk(i, path, ray, WHITE, get_camera_pdf(i, ray.direction), BDPT_MAX_DEPTH + 1);
+    }
+
+    static void light_subpath(struct renderer_info& i, subpath_t& path)
+    {
+        scene_t *scene = i.scene;
+
+        path.count = 0;
+        if (scene->lights.size() == 0)
+            return;
+
+        area_light_t *l = pick_light(scene);
+
+        vertex_t& v = path.v[0];
+        v.type = VERTEX_LIGHT;
+        v.position = sample_area_light(l);
+        v.normal = area_light_normal(l);
+        v.albedo = BLACK;
+        v.light = l;
+        v.pdf_fwd = light_origin_pdf(scene, v);
+        v.pdf_rev = 0.f;
+        v.beta = l->mlt.emission * l->power * (1.f / v.pdf_fwd);
+        path.count = 1;
+
+        ray_t r;
+        r.direction = get_cosine_hemisphere_random(v.normal);
+        r.origin = v.position + v.normal * F_EPSYLON;
+
+        // Le * cos / (pdf_origin * pdf_dir), with pdf_dir = cos / PI
+        random_walk(i, path, r, v.beta * PI, emission_pdf(v, r.direction), BDPT_MAX_DEPTH);
+    }
+
+    // Geometric term without visibility; the pinhole has no cosine
+    static float geometry_term(const vertex_t& a, const vertex_t& b)
+    {
+        vec3_t d = b.position - a.position;
+        float inv_dist2 = 1.f / dot(d, d);
+        vec3_t w = d * sqrtf(inv_dist2);
+        float g = inv_dist2;
+
+        if (a.type != VERTEX_CAMERA)
+            g *= fabs(dot(a.normal, w));
+        if (b.type != VERTEX_CAMERA)
+            g *= fabs(dot(b.normal, w));
+        return g;
+    }
+
+    static bool visible(scene_t *scene, const vertex_t& from, const vertex_t& to)
+    {
+        vec3_t d = to.position - from.position;
+        float dist = magnitude(d);
+        ray_t r;
+        hit_t h;
+
+        r.direction = d * (1.f / dist);
+        r.origin = from.position
+                 + from.normal * (dot(from.normal, r.direction) > 0.f ? F_EPSYLON : -F_EPSYLON);
+
+        // Missing everything is fine: the camera floats outside the scene
+        if (!intersect_scene(scene, r, &h, RAY_SHADOW))
+            return true;
+        return magnitude(h.position - r.origin) >= dist * (1.f - 1e-3f);
+    }
+
+    static float mis_ratio(float rev, float fwd)
+    {
+        float r = (rev != 0.f ? rev : 1.f) / (fwd != 0.f ? fwd : 1.f);
+        return r * r;
+    }
+
+    // Power heuristic weight of strategy (s, t) against every other way of
+    // sampling the same path.
+    static float mis_weight(struct renderer_info& i, const subpath_t& light,
+                            const subpath_t& cam, uint32_t s, uint32_t t)
+    {
+        if (s + t == 2)
+            return 1.f;
+
+        const vertex_t *qs = s > 0 ? &light.v[s - 1] : nullptr;
+        const vertex_t *qs_minus = s > 1 ? &light.v[s - 2] : nullptr;
+        const vertex_t *pt = &cam.v[t - 1];
+        const vertex_t *pt_minus = t > 1 ? &cam.v[t - 2] : nullptr;
+
+        // Reverse densities of the connection vertices and their neighbours,
+        // as seen through this strategy
+        float pt_rev = 0.f, pt_minus_rev = 0.f, qs_rev = 0.f, qs_minus_rev = 0.f;
+        if (t > 1) {
+            pt_rev = qs ? vertex_pdf(i, *qs, qs_minus, *pt) : light_origin_pdf(i.scene, *pt);
+            pt_minus_rev = vertex_pdf(i, *pt, qs, *pt_minus);
+        }
+        if (qs)
+            qs_rev = vertex_pdf(i, *pt, pt_minus, *qs);
+        if (qs_minus)
+            qs_minus_rev = vertex_pdf(i, *qs, pt, *qs_minus);
+
+        float sum = 0.f;
+        float r = 1.f;
+        for (uint32_t k = t - 1; k > 0; k--) {
+            float rev = k == t - 1 ? pt_rev : k == t - 2 ? pt_minus_rev : cam.v[k].pdf_rev;
+            r *= mis_ratio(rev, cam.v[k].pdf_fwd);
+            sum += r;
+        }
+
+        r = 1.f;
+        for (uint32_t k = s; k-- > 0;) {
+            float rev = k == s - 1 ? qs_rev : k == s - 2 ? qs_minus_rev : light.v[k].pdf_rev;
+            r *= mis_ratio(rev, light.v[k].pdf_fwd);
+            sum += r;
+        }
+
+        return 1.f / (1.f + sum);
+    }
+
+    // Contribution of the path made of the first s light and t camera
+    // vertices. Light tracing (t = 1) goes to `splats`.
+    static vec3_t connect(struct renderer_info& i, const subpath_t& light, const subpath_t& cam,
+                          uint32_t s, uint32_t t, std::vector<splat_t>& splats)
+    {
+        const vertex_t& pt = cam.v[t - 1];
+        vec3_t L;
+        uint32_t x = 0, y = 0;
+
+        if (s == 0) {
+            if (pt.type != VERTEX_LIGHT)
+                return BLACK;
+            if (dot(cam.v[t - 2].position - pt.position, pt.normal) <= 0.f)
+                return BLACK;
+            L = pt.beta * pt.light->mlt.emission * pt.light->power;
+        }
+        else {
+            const vertex_t& qs = light.v[s - 1];
+            if (pt.type == VERTEX_LIGHT)
+                return BLACK;
+
+            vec3_t w = pt.position - qs.position;
+            vec3_t fq = WHITE;
+            vec3_t fp = WHITE;
+
+            if (qs.type == VERTEX_LIGHT)
+                fq = dot(w, qs.normal) > 0.f ? WHITE : BLACK;
+            else
+                fq = vertex_f(qs, light.v[s - 2].position - qs.position, w);
+
+            if (t == 1) {
+                if (!get_pixel_from_camera(i, qs.position, &x, &y))
+                    return BLACK;
+                // Importance of the pinhole, cosine of the image plane included
+                fp = WHITE * get_camera_pdf(i, -w);
+            }
+            else
+                fp = vertex_f(pt, cam.v[t - 2].position - pt.position, -w);
+
+            L = qs.beta * fq * fp * pt.beta * geometry_term(qs, pt);
+            if (L.r + L.g + L.b <= 0.f)
+                return BLACK;
+
+            bool unoccluded = t == 1 ? visible(i.scene, qs, pt) : visible(i.scene, pt, qs);
+            if (!unoccluded)
+                return BLACK;
+        }
+
+        L *= mis_weight(i, light, cam, s, t);
+
+        if (t == 1) {
+            splats.push_back({ x + y * i.width, L });
+            return BLACK;
+        }
+        return L;
+    }
+
+    vec3_t bidir_pathtrace(struct renderer_info& i, ray_t ray, std::vector<splat_t>& splats,
+                           vec3_t *direct)
+    {
+        subpath_t cam;
+        subpath_t light;
+        vec3_t color = BLACK;
+        if (direct)
+            *direct = BLACK;
+
+        camera_subpath(i, ray, cam);
+        light_subpath(i, light);
+
+        for (uint32_t t = 1; t <= cam.count; t++) {
+            for (uint32_t s = 0; s <= light.count; s++) {
+                // s + t - 1 segments, capped as the path tracer's
+                if (s + t < 2 || (s == 1 && t == 1) || s + t - 1 > BDPT_MAX_DEPTH)
+                    continue;
+                vec3_t L = connect(i, light, cam, s, t, splats);
+                color += L;
+                if (direct && s + t - 1 <= 2)
+                    *direct += L;
+            }
+        }
+
+        return color;
+    }
+}
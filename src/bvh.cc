@@ -0,0 +1,626 @@
+#include <algorithm>
+#include <atomic>
+#include <immintrin.h>
+#include <limits>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+#include "bvh.hh"
+
+namespace RE
+{
+    const uint32_t SAH_BINS = 16;
+    // Below, a range isn't worth the start of a thread
+    const uint32_t PARALLEL_REFS = 8192;
+
+    typedef struct build_ref {
+        bbox_t box;
+        vec3_t centroid;
+        uint32_t prim;
+    } build_ref_t;
+
+    static float axis(const vec3_t& v, uint32_t a)
+    {
+        return a == 0 ? v.x : (a == 1 ? v.y : v.z);
+    }
+
+    bbox_t bbox_empty(void)
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        return { vec3_t(inf, inf, inf), vec3_t(-inf, -inf, -inf) };
+    }
+
+    void bbox_grow(bbox_t& b, vec3_t p)
+    {
+        b.min = vec3_t(std::min(b.min.x, p.x), std::min(b.min.y, p.y), std::min(b.min.z, p.z));
+        b.max = vec3_t(std::max(b.max.x, p.x), std::max(b.max.y, p.y), std::max(b.max.z, p.z));
+    }
+
+    // Growing by the corners of o instead would open b to infinity when o is empty
+    void bbox_grow(bbox_t& b, const bbox_t& o)
+    {
+        b.min = vec3_t(std::min(b.min.x, o.min.x), std::min(b.min.y, o.min.y), std::min(b.min.z, o.min.z));
+        b.max = vec3_t(std::max(b.max.x, o.max.x), std::max(b.max.y, o.max.y), std::max(b.max.z, o.max.z));
+    }
+
+    static float half_area(const bbox_t& b)
+    {
+        vec3_t d = b.max - b.min;
+        if (d.x < 0.f)
+            return 0.f;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    // Shared by the tasks of a build: nodes are taken in pairs from the
+    // preallocated array, the leaves index refs until order_leaves().
+    typedef struct build_state {
+        bvh_t& bvh;
+        std::vector<build_ref_t> refs;
+        std::vector<uint32_t> codes; // Morton code of each ref, LBVH only
+        std::atomic<uint32_t> nodes;
+        uint32_t leaf_size;
+    } build_state_t;
+
+    typedef void (*build_task_t)(build_state_t& s, uint32_t node, uint32_t begin,
+                                 uint32_t end, uint32_t depth, uint32_t threads);
+
+    // Calls f(chunk, begin, end) on `chunks` slices of [begin, end), all
+    // but the last on threads of their own
+    template <typename F>
+    static void parallel_chunks(uint32_t chunks, uint32_t begin, uint32_t end, F f)
+    {
+        std::vector<std::thread> threads;
+        uint64_t n = end - begin;
+        for (uint32_t c = 0; c + 1 < chunks; c++)
+            threads.emplace_back(f, c, begin + n * c / chunks, begin + n * (c + 1) / chunks);
+        f(chunks - 1, begin + n * (chunks - 1) / chunks, end);
+        for (std::thread& t : threads)
+            t.join();
+    }
+
+    static bool worth_threads(uint32_t threads, uint32_t begin, uint32_t end)
+    {
+        return threads > 1 && end - begin >= PARALLEL_REFS;
+    }
+
+    // Whether a node of the range at this depth must split in the middle
+    // for its leaves to stay within BVH_MAX_DEPTH
+    static bool too_deep(const build_state_t& s, uint32_t begin, uint32_t end, uint32_t depth)
+    {
+        uint32_t leaves = (end - begin + s.leaf_size - 1) / s.leaf_size;
+        uint32_t balanced = leaves > 1 ? 32 - __builtin_clz(leaves - 1) : 0;
+        return depth + balanced >= BVH_MAX_DEPTH;
+    }
+
+    static void make_leaf(build_state_t& s, uint32_t node, uint32_t begin, uint32_t end)
+    {
+        s.bvh.binary[node].index = begin;
+        s.bvh.binary[node].count = end - begin;
+    }
+
+    // The left subtree on another thread, when worth it, with half the
+    // budget
+    static uint32_t build_children(build_state_t& s, build_task_t task, uint32_t node,
+                                   uint32_t begin, uint32_t mid, uint32_t end, uint32_t depth,
+                                   uint32_t threads)
+    {
+        uint32_t children = s.nodes.fetch_add(2);
+        s.bvh.binary[node].index = children;
+        s.bvh.binary[node].count = 0;
+
+        if (worth_threads(threads, begin, end)) {
+            std::thread left(task, std::ref(s), children, begin, mid, depth + 1, threads / 2);
+            task(s, children + 1, mid, end, depth + 1, threads - threads / 2);
+            left.join();
+        }
+        else {
+            task(s, children, begin, mid, depth + 1, 1);
+            task(s, children + 1, mid, end, depth + 1, 1);
+        }
+        return children;
+    }
+
+    static void bound_refs(const build_state_t& s, uint32_t begin, uint32_t end,
+                           bbox_t& box, bbox_t& centroids)
+    {
+        box = bbox_empty();
+        centroids = bbox_empty();
+        for (uint32_t k = begin; k < end; k++) {
+            bbox_grow(box, s.refs[k].box);
+            bbox_grow(centroids, s.refs[k].centroid);
+        }
+    }
+
+    typedef struct sah_bins {
+        bbox_t box[SAH_BINS];
+        uint32_t count[SAH_BINS];
+    } sah_bins_t;
+
+    // Splits on the bin boundary of the largest centroid axis with the
+    // lowest surface area heuristic, or in the middle when binning can't
+    // separate the centroids or the node is too deep. Large ranges are
+    // bounded and binned in parallel chunks.
+    static void sah_node(build_state_t& s, uint32_t node, uint32_t begin, uint32_t end,
+                         uint32_t depth, uint32_t threads)
+    {
+        bbox_t box, centroids;
+        uint32_t chunks = worth_threads(threads, begin, end) ? threads : 1;
+        if (chunks > 1) {
+            std::vector<bbox_t> boxes(chunks), cents(chunks);
+            parallel_chunks(chunks, begin, end, [&](uint32_t c, uint32_t b, uint32_t e) {
+                bound_refs(s, b, e, boxes[c], cents[c]);
+            });
+            box = boxes[0];
+            centroids = cents[0];
+            for (uint32_t c = 1; c < chunks; c++) {
+                bbox_grow(box, boxes[c]);
+                bbox_grow(centroids, cents[c]);
+            }
+        }
+        else
+            bound_refs(s, begin, end, box, centroids);
+        s.bvh.binary[node].box = box;
+
+        if (end - begin <= s.leaf_size) {
+            make_leaf(s, node, begin, end);
+            return;
+        }
+
+        vec3_t extent = centroids.max - centroids.min;
+        uint32_t a = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                         : (extent.y > extent.z ? 1 : 2);
+        float lo = axis(centroids.min, a);
+        float scale = axis(extent, a) > 0.f ? SAH_BINS / axis(extent, a) : 0.f;
+
+        auto bin_of = [&](const build_ref_t& r) {
+            return std::min(SAH_BINS - 1, (uint32_t)((axis(r.centroid, a) - lo) * scale));
+        };
+
+        uint32_t mid = begin;
+        if (scale > 0.f && !too_deep(s, begin, end, depth)) {
+            std::vector<sah_bins_t> chunk_bins(chunks);
+            parallel_chunks(chunks, begin, end, [&](uint32_t c, uint32_t b, uint32_t e) {
+                sah_bins_t& bins = chunk_bins[c];
+                for (uint32_t k = 0; k < SAH_BINS; k++) {
+                    bins.box[k] = bbox_empty();
+                    bins.count[k] = 0;
+                }
+                for (uint32_t k = b; k < e; k++) {
+                    uint32_t i = bin_of(s.refs[k]);
+                    bbox_grow(bins.box[i], s.refs[k].box);
+                    bins.count[i]++;
+                }
+            });
+
+            sah_bins_t& bins = chunk_bins[0];
+            for (uint32_t c = 1; c < chunks; c++) {
+                for (uint32_t k = 0; k < SAH_BINS; k++) {
+                    bbox_grow(bins.box[k], chunk_bins[c].box[k]);
+                    bins.count[k] += chunk_bins[c].count[k];
+                }
+            }
+
+            // Cost of the right side of each split, swept from the right
+            float right_cost[SAH_BINS];
+            bbox_t right = bbox_empty();
+            uint32_t right_count = 0;
+            for (uint32_t b = SAH_BINS - 1; b > 0; b--) {
+                bbox_grow(right, bins.box[b]);
+                right_count += bins.count[b];
+                right_cost[b] = right_count * half_area(right);
+            }
+
+            float best = std::numeric_limits<float>::infinity();
+            uint32_t split = 0;
+            bbox_t left = bbox_empty();
+            uint32_t left_count = 0;
+            for (uint32_t b = 1; b < SAH_BINS; b++) {
+                bbox_grow(left, bins.box[b - 1]);
+                left_count += bins.count[b - 1];
+                float cost = left_count * half_area(left) + right_cost[b];
+                if (left_count > 0 && left_count < end - begin && cost < best) {
+                    best = cost;
+                    split = b;
+                }
+            }
+
+            if (split > 0) {
+                auto it = std::partition(s.refs.begin() + begin, s.refs.begin() + end,
+                                         [&](const build_ref_t& r) { return bin_of(r) < split; });
+                mid = it - s.refs.begin();
+            }
+        }
+
+        if (mid == begin || mid == end) {
+            mid = (begin + end) / 2;
+            std::nth_element(s.refs.begin() + begin, s.refs.begin() + mid, s.refs.begin() + end,
+                             [&](const build_ref_t& l, const build_ref_t& r) {
+                                 return axis(l.centroid, a) < axis(r.centroid, a);
+                             });
+        }
+
+        build_children(s, sah_node, node, begin, mid, end, depth, threads);
+    }
+
+    // 10 bits per axis, interleaved
+    static uint32_t morton_expand(uint32_t v)
+    {
+        v = (v | v << 16) & 0x030000ff;
+        v = (v | v << 8) & 0x0300f00f;
+        v = (v | v << 4) & 0x030c30c3;
+        v = (v | v << 2) & 0x09249249;
+        return v;
+    }
+
+    static uint32_t morton_code(vec3_t p, const bbox_t& centroids)
+    {
+        vec3_t extent = centroids.max - centroids.min;
+        uint32_t q[3];
+        for (uint32_t a = 0; a < 3; a++) {
+            float e = axis(extent, a);
+            float u = e > 0.f ? (axis(p, a) - axis(centroids.min, a)) / e : 0.f;
+            q[a] = std::min(1023u, (uint32_t)(u * 1024.f));
+        }
+        return morton_expand(q[0]) << 2 | morton_expand(q[1]) << 1 | morton_expand(q[2]);
+    }
+
+    // Sorts the refs along the Morton curve of their centroids: chunks
+    // sorted on their own threads, then merged pairwise
+    static void morton_sort(build_state_t& s, uint32_t threads)
+    {
+        uint32_t n = s.refs.size();
+        bbox_t centroids = bbox_empty();
+        for (const build_ref_t& r : s.refs)
+            bbox_grow(centroids, r.centroid);
+
+        uint32_t chunks = worth_threads(threads, 0, n) ? threads : 1;
+        std::vector<uint64_t> keys(n);
+        std::vector<uint32_t> bounds(chunks + 1);
+        parallel_chunks(chunks, 0, n, [&](uint32_t c, uint32_t b, uint32_t e) {
+            for (uint32_t k = b; k < e; k++)
+                keys[k] = (uint64_t)morton_code(s.refs[k].centroid, centroids) << 32 | k;
+            std::sort(keys.begin() + b, keys.begin() + e);
+            bounds[c + 1] = e;
+        });
+
+        for (uint32_t width = 1; width < chunks; width *= 2) {
+            std::vector<std::thread> merges;
+            for (uint32_t c = 0; c + width < chunks; c += 2 * width) {
+                auto first = keys.begin() + bounds[c];
+                auto middle = keys.begin() + bounds[c + width];
+                auto last = keys.begin() + bounds[std::min(c + 2 * width, chunks)];
+                merges.emplace_back([=]() { std::inplace_merge(first, middle, last); });
+            }
+            for (std::thread& t : merges)
+                t.join();
+        }
+
+        std::vector<build_ref_t> sorted(n);
+        s.codes.resize(n);
+        for (uint32_t k = 0; k < n; k++) {
+            sorted[k] = s.refs[keys[k] & 0xffffffff];
+            s.codes[k] = keys[k] >> 32;
+        }
+        s.refs.swap(sorted);
+    }
+
+    // Splits the sorted range where its highest differing code bit turns
+    // on, or in the middle among equal codes or when the node is too deep.
+    // Bounded on the way up.
+    static void lbvh_node(build_state_t& s, uint32_t node, uint32_t begin, uint32_t end,
+                          uint32_t depth, uint32_t threads)
+    {
+        bvh_node2_t& n = s.bvh.binary[node];
+        if (end - begin <= s.leaf_size) {
+            bbox_t centroids;
+            bound_refs(s, begin, end, n.box, centroids);
+            make_leaf(s, node, begin, end);
+            return;
+        }
+
+        uint32_t first = s.codes[begin], last = s.codes[end - 1];
+        uint32_t mid = (begin + end) / 2;
+        if (first != last && !too_deep(s, begin, end, depth)) {
+            uint32_t bit = 31 - __builtin_clz(first ^ last);
+            mid = std::partition_point(s.codes.begin() + begin, s.codes.begin() + end,
+                                       [&](uint32_t c) { return !(c >> bit & 1); })
+                - s.codes.begin();
+        }
+
+        uint32_t children = build_children(s, lbvh_node, node, begin, mid, end, depth, threads);
+        n.box = s.bvh.binary[children].box;
+        bbox_grow(n.box, s.bvh.binary[children + 1].box);
+    }
+
+    // Replaces the ranges of refs of the leaves by ranges of order, depth
+    // first, each padded to a multiple of leaf_align
+    static void order_leaves(build_state_t& s, uint32_t node, uint32_t leaf_align,
+                             std::vector<uint32_t>& order)
+    {
+        bvh_node2_t& n = s.bvh.binary[node];
+        if (n.count == 0) {
+            order_leaves(s, n.index, leaf_align, order);
+            order_leaves(s, n.index + 1, leaf_align, order);
+            return;
+        }
+
+        uint32_t begin = n.index;
+        n.index = order.size();
+        for (uint32_t k = begin; k < begin + n.count; k++)
+            order.push_back(s.refs[k].prim);
+        while (order.size() % leaf_align)
+            order.push_back(NO_PRIMITIVE);
+    }
+
+    // Pulls the grandchildren of the binary node up until it has
+    // BVH_WIDTH children, opening the largest inner child first.
+    static uint32_t collapse_node(bvh_t& bvh, uint32_t node)
+    {
+        const std::vector<bvh_node2_t>& binary = bvh.binary;
+        uint32_t slots[BVH_WIDTH];
+        uint32_t count = 0;
+
+        if (binary[node].count)
+            slots[count++] = node;
+        else {
+            slots[count++] = binary[node].index;
+            slots[count++] = binary[node].index + 1;
+        }
+
+        while (count < BVH_WIDTH) {
+            int32_t open = -1;
+            float area = -1.f;
+            for (uint32_t k = 0; k < count; k++) {
+                const bvh_node2_t& c = binary[slots[k]];
+                if (c.count == 0 && half_area(c.box) > area) {
+                    area = half_area(c.box);
+                    open = k;
+                }
+            }
+            if (open < 0)
+                break;
+
+            uint32_t c = binary[slots[open]].index;
+            slots[open] = c;
+            slots[count++] = c + 1;
+        }
+
+        uint32_t wide = bvh.wide.size();
+        bvh_node_t n;
+        for (uint32_t k = 0; k < BVH_WIDTH; k++) {
+            bbox_t b = k < count ? binary[slots[k]].box : bbox_empty();
+            for (uint32_t a = 0; a < 3; a++) {
+                n.lo[a][k] = axis(b.min, a);
+                n.hi[a][k] = axis(b.max, a);
+            }
+            n.index[k] = k < count ? binary[slots[k]].index : 0;
+            n.count[k] = k < count ? binary[slots[k]].count : 0;
+        }
+        bvh.wide.push_back(n);
+
+        for (uint32_t k = 0; k < count; k++) {
+            if (binary[slots[k]].count == 0) {
+                uint32_t child = collapse_node(bvh, slots[k]);
+                bvh.wide[wide].index[k] = child;
+            }
+        }
+        return wide;
+    }
+
+    void bvh_build(bvh_t& bvh, const std::vector<bbox_t>& boxes, uint32_t leaf_size,
+                   uint32_t leaf_align, bvh_builder_e builder, uint32_t threads,
+                   std::vector<uint32_t>& order)
+    {
+        bvh = bvh_t();
+        build_state_t s = { bvh, std::vector<build_ref_t>(boxes.size()), {}, { 1 }, leaf_size };
+        for (uint32_t k = 0; k < boxes.size(); k++)
+            s.refs[k] = { boxes[k], (boxes[k].min + boxes[k].max) * 0.5f, k };
+
+        // A leaf holds at least one primitive: at most 2n - 1 nodes
+        bvh.binary.resize(boxes.empty() ? 1 : 2 * boxes.size() - 1);
+        threads = std::max(1u, threads);
+        if (builder == BVH_BUILD_LBVH) {
+            morton_sort(s, threads);
+            lbvh_node(s, 0, 0, s.refs.size(), 0, threads);
+        }
+        else
+            sah_node(s, 0, 0, s.refs.size(), 0, threads);
+        bvh.binary.resize(s.nodes);
+
+        order.clear();
+        order_leaves(s, 0, leaf_align, order);
+        collapse_node(bvh, 0);
+        bvh.bounds = bvh.binary[0].box;
+    }
+
+    bbox_t bvh_bounds(const bvh_t& bvh)
+    {
+        return bvh.bounds;
+    }
+
+    static float exp2i(int32_t e)
+    {
+        uint32_t bits = (uint32_t)(e + 127) << 23;
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // The smallest power of two step that covers every child in 255 of
+    // them, rounding their bounds outwards
+    static void quantize_axis(const bvh_node_t& n, uint32_t children, uint32_t a,
+                              bvh_qnode_t& q)
+    {
+        float lo = n.lo[a][0], hi = n.hi[a][0];
+        for (uint32_t c = 1; c < children; c++) {
+            lo = std::min(lo, n.lo[a][c]);
+            hi = std::max(hi, n.hi[a][c]);
+        }
+
+        int32_t e = hi > lo ? (int32_t)ceilf(log2f((hi - lo) / 255.f)) : 0;
+        for (e = clamp(e, -100, 100); ; e++) {
+            float step = exp2i(e);
+            bool fits = true;
+
+            for (uint32_t c = 0; c < children; c++) {
+                int32_t ql = floorf((n.lo[a][c] - lo) / step);
+                int32_t qh = ceilf((n.hi[a][c] - lo) / step);
+                for (; ql > 0 && lo + ql * step > n.lo[a][c]; ql--)
+                    ;
+                for (; lo + qh * step < n.hi[a][c]; qh++)
+                    ;
+                fits &= ql >= 0 && qh <= 255;
+                q.lo[a][c] = clamp(ql, 0, 255);
+                q.hi[a][c] = clamp(qh, 0, 255);
+            }
+            if (fits)
+                break;
+        }
+
+        q.origin[a] = lo;
+        q.exponent[a] = e;
+        for (uint32_t c = children; c < BVH_WIDTH; c++) {
+            q.lo[a][c] = 255;
+            q.hi[a][c] = 0;
+        }
+    }
+
+    bool bvh_quantize(bvh_t& bvh)
+    {
+        for (const bvh_node_t& n : bvh.wide) {
+            for (uint32_t c = 0; c < BVH_WIDTH; c++) {
+                if (n.count[c] >= 32 || n.index[c] >= (1u << 27))
+                    return false;
+            }
+        }
+
+        bvh.quantized.resize(bvh.wide.size());
+
+        for (uint32_t k = 0; k < bvh.wide.size(); k++) {
+            const bvh_node_t& n = bvh.wide[k];
+            bvh_qnode_t& q = bvh.quantized[k];
+
+            uint32_t children = 0;
+            while (children < BVH_WIDTH && n.lo[0][children] <= n.hi[0][children])
+                children++;
+
+            q.children = children;
+            for (uint32_t a = 0; a < 3; a++)
+                quantize_axis(n, children, a, q);
+            for (uint32_t c = 0; c < BVH_WIDTH; c++)
+                q.child[c] = c < children ? n.index[c] << 5 | n.count[c] : 0;
+        }
+
+        bvh.binary = std::vector<bvh_node2_t>();
+        bvh.wide = std::vector<bvh_node_t>();
+        return true;
+    }
+
+    bvh_ray_t get_bvh_ray(const ray_t& r)
+    {
+        bvh_ray_t br;
+        const float o[3] = { r.origin.x, r.origin.y, r.origin.z };
+        const float d[3] = { r.direction.x, r.direction.y, r.direction.z };
+
+        for (uint32_t a = 0; a < 3; a++) {
+            br.origin[a] = o[a];
+            br.inv_direction[a] = 1.f / d[a];
+            br.negative[a] = br.inv_direction[a] < 0.f;
+        }
+        return br;
+    }
+
+    // Entering by the near side of each slab, an inverted box is left
+    // before it is entered.
+    bool bvh_box_hit(const bbox_t& b, const bvh_ray_t& r, float t, float *dist)
+    {
+        float near = 0.f, far = t;
+        for (uint32_t a = 0; a < 3; a++) {
+            float lo = axis(r.negative[a] ? b.max : b.min, a);
+            float hi = axis(r.negative[a] ? b.min : b.max, a);
+            near = std::max(near, (lo - r.origin[a]) * r.inv_direction[a]);
+            far = std::min(far, (hi - r.origin[a]) * r.inv_direction[a]);
+        }
+        *dist = near;
+        return near <= far;
+    }
+
+#if BVH_WIDTH == 8
+    typedef __m256 vnode_t;
+
+    static inline vnode_t n_set1(float a) { return _mm256_set1_ps(a); }
+    static inline vnode_t n_load(const float *p) { return _mm256_loadu_ps(p); }
+    static inline void n_store(float *p, vnode_t a) { _mm256_storeu_ps(p, a); }
+    static inline vnode_t n_add(vnode_t a, vnode_t b) { return _mm256_add_ps(a, b); }
+    static inline vnode_t n_sub(vnode_t a, vnode_t b) { return _mm256_sub_ps(a, b); }
+    static inline vnode_t n_mul(vnode_t a, vnode_t b) { return _mm256_mul_ps(a, b); }
+    static inline vnode_t n_min(vnode_t a, vnode_t b) { return _mm256_min_ps(a, b); }
+    static inline vnode_t n_max(vnode_t a, vnode_t b) { return _mm256_max_ps(a, b); }
+    static inline uint32_t n_le_bits(vnode_t a, vnode_t b)
+    {
+        return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ));
+    }
+    static inline vnode_t n_load_u8(const uint8_t *p)
+    {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+    }
+#else
+    typedef __m128 vnode_t;
+
+    static inline vnode_t n_set1(float a) { return _mm_set1_ps(a); }
+    static inline vnode_t n_load(const float *p) { return _mm_loadu_ps(p); }
+    static inline void n_store(float *p, vnode_t a) { _mm_storeu_ps(p, a); }
+    static inline vnode_t n_add(vnode_t a, vnode_t b) { return _mm_add_ps(a, b); }
+    static inline vnode_t n_sub(vnode_t a, vnode_t b) { return _mm_sub_ps(a, b); }
+    static inline vnode_t n_mul(vnode_t a, vnode_t b) { return _mm_mul_ps(a, b); }
+    static inline vnode_t n_min(vnode_t a, vnode_t b) { return _mm_min_ps(a, b); }
+    static inline vnode_t n_max(vnode_t a, vnode_t b) { return _mm_max_ps(a, b); }
+    static inline uint32_t n_le_bits(vnode_t a, vnode_t b)
+    {
+        return _mm_movemask_ps(_mm_cmple_ps(a, b));
+    }
+    static inline vnode_t n_load_u8(const uint8_t *p)
+    {
+        int32_t bytes;
+        memcpy(&bytes, p, sizeof(bytes));
+        __m128i zero = _mm_setzero_si128();
+        __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+    }
+#endif
+
+    // bvh_box_hit on every child at once
+    uint32_t bvh_node_hits(const bvh_node_t& n, const bvh_ray_t& r, float t,
+                           float dist[BVH_WIDTH])
+    {
+        vnode_t near = n_set1(0.f), far = n_set1(t);
+        for (uint32_t a = 0; a < 3; a++) {
+            const float *lo = r.negative[a] ? n.hi[a] : n.lo[a];
+            const float *hi = r.negative[a] ? n.lo[a] : n.hi[a];
+            vnode_t o = n_set1(r.origin[a]), inv = n_set1(r.inv_direction[a]);
+            near = n_max(near, n_mul(n_sub(n_load(lo), o), inv));
+            far = n_min(far, n_mul(n_sub(n_load(hi), o), inv));
+        }
+        n_store(dist, near);
+        return n_le_bits(near, far);
+    }
+
+    // The same on the dequantized bounds: origin + q * step, in ray space
+    // q * (step / d) + (origin - o) / d
+    uint32_t bvh_node_hits(const bvh_qnode_t& n, const bvh_ray_t& r, float t,
+                           float dist[BVH_WIDTH])
+    {
+        vnode_t near = n_set1(0.f), far = n_set1(t);
+        for (uint32_t a = 0; a < 3; a++) {
+            const uint8_t *lo = r.negative[a] ? n.hi[a] : n.lo[a];
+            const uint8_t *hi = r.negative[a] ? n.lo[a] : n.hi[a];
+            vnode_t scale = n_set1(exp2i(n.exponent[a]) * r.inv_direction[a]);
+            vnode_t offset = n_set1((n.origin[a] - r.origin[a]) * r.inv_direction[a]);
+            near = n_max(near, n_add(n_mul(n_load_u8(lo), scale), offset));
+            far = n_min(far, n_add(n_mul(n_load_u8(hi), scale), offset));
+        }
+        n_store(dist, near);
+        return n_le_bits(near, far) & ((1u << n.children) - 1);
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include "raytracing.hh"
+#include "stats.hh"
+#include "types.hh"
+
+// Binned SAH hierarchies, traversed as built (binary) or collapsed to
+// BVH_WIDTH children per node, whose bounds one SIMD slab test covers. The
+// wide nodes can be quantized for large scenes, where the traversal waits
+// on memory more than on the slab tests. For previews, an LBVH (split along
+// the Morton curve of the centroids) builds several times faster.
+
+namespace RE
+{
+    bbox_t bbox_empty(void);
+    void bbox_grow(bbox_t& b, vec3_t p);
+    void bbox_grow(bbox_t& b, const bbox_t& o);
+
+    // Builds the hierarchy of the primitives bounded by `boxes`, leaves
+    // of at most leaf_size of them. `order` receives their indices in leaf
+    // order, each leaf padded with NO_PRIMITIVE to a multiple of
+    // leaf_align: the leaves index it. The subtrees of large ranges are
+    // built on up to `threads` threads, the hierarchy is the same whatever
+    // their count.
+    void bvh_build(bvh_t& bvh, const std::vector<bbox_t>& boxes, uint32_t leaf_size,
+                   uint32_t leaf_align, bvh_builder_e builder, uint32_t threads,
+                   std::vector<uint32_t>& order);
+
+    bbox_t bvh_bounds(const bvh_t& bvh);
+
+    // Replaces the nodes of the hierarchy with the quantized form of the
+    // wide ones. False when a child index does not fit its packed form: the
+    // hierarchy is left as is, and traced wide.
+    bool bvh_quantize(bvh_t& bvh);
+
+    typedef struct bvh_ray {
+        float origin[3];
+        float inv_direction[3];
+        bool negative[3]; // The hi side is entered first
+    } bvh_ray_t;
+
+    bvh_ray_t get_bvh_ray(const ray_t& r);
+
+    // Whether the ray enters the box before t, at *dist
+    bool bvh_box_hit(const bbox_t& b, const bvh_ray_t& r, float t, float *dist);
+    // The children of the node the ray enters before t (bit c for child c),
+    // at dist[c]
+    uint32_t bvh_node_hits(const bvh_node_t& n, const bvh_ray_t& r, float t,
+                           float dist[BVH_WIDTH]);
+    uint32_t bvh_node_hits(const bvh_qnode_t& n, const bvh_ray_t& r, float t,
+                           float dist[BVH_WIDTH]);
+
+    typedef struct bvh_entry {
+        uint32_t index;
+        uint32_t count;
+        float dist;
+    } bvh_entry_t;
+
+    inline bvh_entry_t bvh_child(const bvh_node_t& n, uint32_t c, float dist)
+    {
+        return { n.index[c], n.count[c], dist };
+    }
+
+    inline bvh_entry_t bvh_child(const bvh_qnode_t& n, uint32_t c, float dist)
+    {
+        return { n.child[c] >> 5, n.child[c] & 31, dist };
+    }
+
+    // Deepest level of the binary hierarchy: past the depth a balanced
+    // subtree of their range needs, the builders split in the middle
+    const uint32_t BVH_MAX_DEPTH = 64;
+    // A wide node leaves at most BVH_WIDTH - 1 siblings on the stack per
+    // level, the binary ones 1
+    const uint32_t BVH_STACK_SIZE = BVH_WIDTH * BVH_MAX_DEPTH;
+    // The slab distances round differently from the primitive tests: the
+    // boxes are kept up to this factor past *t, where they may hold a tie
+    const float BVH_ROUNDING = 1.0000004f;
+
+    // The wide and quantized layouts: the hit children are sorted on the
+    // way in, the nearest on top
+    template <typename Nodes, typename F>
+    void bvh_traverse_wide(const Nodes& nodes, const bvh_ray_t& br, float *t, F& leaf)
+    {
+        bvh_entry_t stack[BVH_STACK_SIZE];
+        uint32_t size = 0;
+
+        stack[size++] = { 0, 0, 0.f };
+        while (size > 0) {
+            bvh_entry_t e = stack[--size];
+            if (e.dist > *t * BVH_ROUNDING)
+                continue;
+            if (e.count) {
+                leaf(e.index, e.count);
+                continue;
+            }
+
+            STATS_INC(node_traversals);
+            const auto& n = nodes[e.index];
+            float dist[BVH_WIDTH];
+            uint32_t hits = bvh_node_hits(n, br, *t * BVH_ROUNDING, dist);
+
+            uint32_t bottom = size;
+            while (hits) {
+                uint32_t c = __builtin_ctz(hits);
+                hits &= hits - 1;
+
+                bvh_entry_t child = bvh_child(n, c, dist[c]);
+                uint32_t k = size++;
+                for (; k > bottom && stack[k - 1].dist < child.dist; k--)
+                    stack[k] = stack[k - 1];
+                stack[k] = child;
+            }
+            assert(size <= BVH_STACK_SIZE - BVH_WIDTH && "BVH too deep");
+        }
+    }
+
+    // Calls leaf(index, count) on the leaves the ray enters by *t, nearest
+    // first. leaf lowers *t on a hit, which prunes the rest (a leaf entered
+    // at *t exactly may still hold a tie).
+    template <typename F>
+    void bvh_traverse(const bvh_t& bvh, bvh_layout_e layout, const ray_t& r, float *t, F leaf)
+    {
+        bvh_ray_t br = get_bvh_ray(r);
+
+        if (layout == BVH_QUANTIZED && !bvh.quantized.empty()) {
+            bvh_traverse_wide(bvh.quantized, br, t, leaf);
+            return;
+        }
+        if (layout != BVH_BINARY) {
+            bvh_traverse_wide(bvh.wide, br, t, leaf);
+            return;
+        }
+
+        bvh_entry_t stack[BVH_STACK_SIZE];
+        uint32_t size = 0;
+
+        stack[size++] = { 0, 0, 0.f };
+        while (size > 0) {
+            bvh_entry_t e = stack[--size];
+            if (e.dist > *t * BVH_ROUNDING)
+                continue;
+
+            const bvh_node2_t& n = bvh.binary[e.index];
+            if (n.count) {
+                leaf(n.index, n.count);
+                continue;
+            }
+
+            STATS_INC(node_traversals);
+            float d0, d1;
+            bool h0 = bvh_box_hit(bvh.binary[n.index].box, br, *t * BVH_ROUNDING, &d0);
+            bool h1 = bvh_box_hit(bvh.binary[n.index + 1].box, br, *t * BVH_ROUNDING, &d1);
+
+            if (h0 && h1 && d1 < d0) {
+                stack[size++] = { n.index, 0, d0 };
+                stack[size++] = { n.index + 1, 0, d1 };
+            }
+            else {
+                if (h1)
+                    stack[size++] = { n.index + 1, 0, d1 };
+                if (h0)
+                    stack[size++] = { n.index, 0, d0 };
+            }
+            assert(size <= BVH_STACK_SIZE - 2 && "BVH too deep");
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include <math.h>
+
+#include "helpers.hh"
+#include "renderer.hh"
+
+// Pinhole or thin lens camera. camera_init() computes, once per frame, the
+// basis and the position of the top left pixel corner on the image plane
+// at unit distance: a film position is then a point of that plane, two
+// multiply-adds away.
+
+namespace RE
+{
+    void camera_init(camera_t& c, uint32_t width, uint32_t height, bool lens)
+    {
+        c.forward = normalize(c.direction);
+        c.right = normalize(cross(c.up, c.forward));
+        c.true_up = cross(c.forward, c.right);
+        c.plane_distance = width / (tanf(DEG2RAD * c.fov * 0.5f) * 2.f);
+
+        c.step_x = c.right * (1.f / c.plane_distance);
+        c.step_y = -c.true_up * (1.f / c.plane_distance);
+        c.corner = c.forward - c.step_x * (width * 0.5f) - c.step_y * (height * 0.5f);
+        c.thin_lens = lens && c.lens_radius > 0.f;
+    }
+
+    // Concentric mapping of the unit square on the unit disk (Shirley)
+    static void sample_disk(float u, float v, float *x, float *y)
+    {
+        float a = 2.f * u - 1.f;
+        float b = 2.f * v - 1.f;
+        if (a == 0.f && b == 0.f) {
+            *x = 0.f;
+            *y = 0.f;
+            return;
+        }
+
+        float r, phi;
+        if (fabsf(a) > fabsf(b)) {
+            r = a;
+            phi = (PI / 4.f) * (b / a);
+        }
+        else {
+            r = b;
+            phi = (PI / 2.f) - (PI / 4.f) * (a / b);
+        }
+        *x = r * cosf(phi);
+        *y = r * sinf(phi);
+    }
+
+    ray_t camera_ray(const camera_t& c, float fx, float fy, float u, float v)
+    {
+        vec3_t d = c.corner + c.step_x * fx + c.step_y * fy;
+        if (!c.thin_lens)
+            return { c.position, normalize(d) };
+
+        // d has a unit forward component: the focus plane is reached at
+        // focus_distance times d
+        float lx, ly;
+        sample_disk(u, v, &lx, &ly);
+        vec3_t origin = c.position + (c.right * lx + c.true_up * ly) * c.lens_radius;
+        vec3_t focus = c.position + d * c.focus_distance;
+        return { origin, normalize(focus - origin) };
+    }
+
+    ray_t get_ray_from_film(struct renderer_info& i, float fx, float fy)
+    {
+        const camera_t& c = i.scene->camera;
+        if (!c.thin_lens)
+            return camera_ray(c, fx, fy, 0.f, 0.f);
+        float u = rand_0_1();
+        return camera_ray(c, fx, fy, u, rand_0_1());
+    }
+
+    ray_t get_ray_from_camera(struct renderer_info& i, uint32_t x, uint32_t y)
+    {
+        return get_ray_from_film(i, x + 0.5f, y + 0.5f);
+    }
+
+    bool get_pixel_from_camera(struct renderer_info& i, vec3_t p, uint32_t *x, uint32_t *y)
+    {
+        const camera_t& c = i.scene->camera;
+        vec3_t d = p - c.position;
+        float depth = dot(d, c.forward);
+        if (depth <= 0.f)
+            return false;
+
+        // Inverse of camera_ray: project on the image plane
+        d *= c.plane_distance / depth;
+        float px = dot(d, c.right) + i.width * 0.5f;
+        float py = -dot(d, c.true_up) + i.height * 0.5f;
+
+        if (px < 0.f || py < 0.f || px >= i.width || py >= i.height)
+            return false;
+
+        *x = px;
+        *y = py;
+        return true;
+    }
+
+    float get_camera_pdf(struct renderer_info& i, vec3_t direction)
+    {
+        const camera_t& c = i.scene->camera;
+        float cos_theta = dot(normalize(direction), c.forward);
+        if (cos_theta <= 0.f)
+            return 0.f;
+
+        // Image plane area at unit distance: pixels are 1 / L wide there
+        float L = c.plane_distance;
+        float area = i.width * i.height / (L * L);
+        return 1.f / (area * cos_theta * cos_theta * cos_theta);
+    }
+}
@@ -4,6 +4,8 @@
 //#define USE_PATHTRACER
 #define USE_BIDIR_PATHTRACER
 //#define USE_MDT
+//#define USE_PHOTON_MAPPER
+//#define USE_MLT
 
 // Enable this to only render a part of the front sphere
 //#define RENDER_PARTIAL
@@ -12,10 +14,50 @@
 #define HEIGHT 256
 #define STRIDE 4 //(RGBA)
 #define MAX_THREADS 4
+#define TILE_SIZE 16
+
+// Spreads the path tracer and BDPT samples, each at a random position in
+// its pixel: FILTER_BOX, FILTER_TENT, FILTER_GAUSSIAN or FILTER_MITCHELL
+#define PIXEL_FILTER FILTER_GAUSSIAN
+
+// Per-tile render time as false-color <prefix>.png + <prefix>.csv
+//#define RENDER_HEATMAP "heatmap"
+
+// Every output variable (depth, normal, albedo...) as <prefix>-<name>.pfm
+//#define RENDER_AOVS "aov"
+
+// Edge-avoiding a-trous filter over the final image, guided by the first hit
+//#define DENOISE
+#define DENOISE_ITERATIONS 5 // Taps spread up to 2^(N-1) * 2 pixels away
+#define DENOISE_SIGMA_LUMINANCE 4.f // In standard deviations of the pixel noise
+#define DENOISE_SIGMA_NORMAL 128.f
+#define DENOISE_SIGMA_DEPTH 1.f
+
+// Hit the triangles from both sides instead of culling their back faces
+//#define TRI_DOUBLE_SIDED
+
+// Ray counters and per-thread timings, reported after the render
+#define ENABLE_STATS
+//#define STATS_JSON_PATH "stats.json"
 
 // Pathtracer setings
 #define PT_SAMPLES 128
-#define PT_MAX_DEPTH 3
+#define PT_MAX_DEPTH 16 // Hard cap, Russian roulette ends most paths before
+#define PT_RR_MIN_DEPTH 3
+#define PT_NEE // Sample the area lights at each vertex (MIS with the BSDF)
+//#define PT_IRRADIANCE_CACHE // Interpolate indirect light at camera hits, needs PT_NEE
+#define IC_ERROR 0.3f // Interpolation error bound
+#define IC_MIN_RADIUS 0.05f
+#define IC_MAX_RADIUS 4.f
+#define IC_THETA_SAMPLES 8 // Hemisphere strata per record
+#define IC_PHI_SAMPLES 24
+#define IC_FIRST_STRIDE 16 // Pixel spacing of the first filling round
+//#define PT_GUIDING // Learn where the light comes from and sample bounces from it
+#define PG_ITERATIONS 7 // Training passes, with 1, 2, 4... samples per pixel
+#define PG_BSDF_FRACTION 0.5f // Bounces still drawn from the BSDF
+#define PG_SPATIAL_THRESHOLD 4000 // Records per spatial leaf, times sqrt(2^pass)
+#define PG_SUBDIVIDE_ENERGY 0.01f // Share of the radiance a quadrant needs to be split
+#define PG_MAX_DTREE_DEPTH 20
 
 // Raytracer settings
 //#define RT_ENABLE_SHADOWS
@@ -25,9 +67,29 @@
 // MDT settings
 #define IR_RAY_PER_LIGHT 32
 #define IR_RAY_DEPTH 1
+#define MDT_LIGHTCUTS // Gather the lights through a light tree
+//#define MDT_LIGHT_SAMPLES 16 // Gather N lights drawn by intensity instead
+#define MDT_LIGHTCUTS_ERROR 0.02f // Relative error allowed per cluster
+#define MDT_LIGHTCUTS_MAX_CUT 1000
+
+// Photon mapping settings
+#define PM_PASSES 64
+#define PM_PHOTONS 20000 // Per pass
+#define PM_MAX_DEPTH 16
+#define PM_RR_MIN_DEPTH 3
+#define PM_NEAREST 64 // Photons used to set the initial gather radius
+#define PM_MAX_RADIUS 1.f
+#define PM_ALPHA 0.7f // Fraction of the new photons kept at each pass
 
 // Bidirectionnal pathracing 
-#define BDPT_MAX_CRAY_DEPTH 3
-#define BDPT_MAX_LRAY_DEPTH 2
 #define BDPT_SAMPLES 128
-#define BDPT_RAY_PER_LIGHT 32
+#define BDPT_MAX_DEPTH 16 // Segments per path, as PT_MAX_DEPTH
+#define BDPT_RR_MIN_DEPTH 3
+
+// Metropolis light transport settings
+#define MLT_SAMPLES 128 // Mutations per pixel
+#define MLT_BIDIR // Mutate bidirectional paths instead of path traced ones
+#define MLT_BOOTSTRAP 100000 // Paths averaged to normalize the image
+#define MLT_CHAINS 64
+#define MLT_LARGE_STEP 0.3f // Probability of an independent new path
+#define MLT_SIGMA 0.01f // Deviation of the small steps
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "defines.hh"
+#include "denoise.hh"
+#include "helpers.hh"
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) with the
+// edge-stopping functions of SVGF (Schied et al. 2017). Each iteration is
+// a 5x5 B3-spline blur whose taps spread twice as far as the previous one,
+// weighted down across edges of the first hit: normal, depth, and the
+// luminance difference compared to the local noise level.
+//
+// The filter runs on the illumination: the color divided by the albedo of
+// the first hit, multiplied back at the end, so textures stay sharp.
+
+namespace RE
+{
+    typedef struct pixel_features {
+        vec3_t albedo;
+        vec3_t normal; // Zero when the ray escapes
+        float depth;
+        float depth_dx, depth_dy; // Screen-space gradient
+    } pixel_features_t;
+
+    // B3 spline, by distance to the center tap
+    const float KERNEL[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+    // Its 3x3 binomial sibling, for the variance prefilter
+    const float KERNEL3[2] = { 1.f / 2.f, 1.f / 4.f };
+
+    void denoise(struct renderer_info& i, struct area bounds, vec3_t *film,
+                 const float *variance, const aov_film_t& aovs)
+    {
+        uint32_t w = bounds.w;
+        uint32_t h = bounds.h;
+        std::vector<pixel_features_t> features(w * h);
+        std::vector<vec3_t> color(w * h);
+        std::vector<vec3_t> color_next(w * h);
+        std::vector<float> var(w * h);
+        std::vector<float> var_next(w * h);
+
+        auto film_at = [&](uint32_t x, uint32_t y) -> vec3_t& {
+            return film[bounds.x + x + (bounds.y + y) * i.width];
+        };
+
+        // Dark albedo channels are left modulated: dividing would only
+        // amplify their noise.
+        auto demodulate = [](vec3_t c, vec3_t albedo) {
+            return vec3_t(albedo.r > 1e-3f ? c.r / albedo.r : c.r,
+                          albedo.g > 1e-3f ? c.g / albedo.g : c.g,
+                          albedo.b > 1e-3f ? c.b / albedo.b : c.b);
+        };
+
+        parallel_rows(h, i.thread_count, [&](uint32_t y) {
+            for (uint32_t x = 0; x < w; x++) {
+                pixel_features_t& f = features[x + y * w];
+                f.albedo = aov_read(aovs, AOV_ALBEDO, bounds.x + x, bounds.y + y);
+                f.normal = aov_read(aovs, AOV_NORMAL, bounds.x + x, bounds.y + y);
+                f.depth = aov_read(aovs, AOV_DEPTH, bounds.x + x, bounds.y + y).x;
+                color[x + y * w] = demodulate(film_at(x, y), f.albedo);
+
+                // Moved to the illumination as well, through the luminance
+                float l = std::max(1e-3f, luminance(f.albedo));
+                uint32_t p = bounds.x + x + (bounds.y + y) * i.width;
+                var[x + y * w] = variance ? variance[p] / (l * l) : 0.f;
+            }
+        });
+
+        parallel_rows(h, i.thread_count, [&](uint32_t y) {
+            for (uint32_t x = 0; x < w; x++) {
+                pixel_features_t& f = features[x + y * w];
+                uint32_t xl = x > 0 ? x - 1 : x, xr = x + 1 < w ? x + 1 : x;
+                uint32_t yt = y > 0 ? y - 1 : y, yb = y + 1 < h ? y + 1 : y;
+                f.depth_dx = (features[xr + y * w].depth - features[xl + y * w].depth)
+                           / std::max(1u, xr - xl);
+                f.depth_dy = (features[x + yb * w].depth - features[x + yt * w].depth)
+                           / std::max(1u, yb - yt);
+
+                if (variance)
+                    continue;
+
+                // No per-pixel estimate: spread of the 3x3 neighbourhood
+                float m1 = 0.f, m2 = 0.f, n = 0.f;
+                for (uint32_t v = yt; v <= yb; v++) {
+                    for (uint32_t u = xl; u <= xr; u++) {
+                        float l = luminance(color[u + v * w]);
+                        m1 += l;
+                        m2 += l * l;
+                        n += 1.f;
+                    }
+                }
+                m1 /= n;
+                var[x + y * w] = std::max(0.f, m2 / n - m1 * m1);
+            }
+        });
+
+        for (uint32_t k = 0; k < DENOISE_ITERATIONS; k++) {
+            int32_t step = 1 << k;
+
+            parallel_rows(h, i.thread_count, [&](uint32_t y) {
+                for (uint32_t x = 0; x < w; x++) {
+                    const pixel_features_t& fp = features[x + y * w];
+                    vec3_t cp = color[x + y * w];
+                    float lp = luminance(cp);
+
+                    // The variance is blurred first: a single noisy
+                    // estimate would stop the filter on its own.
+                    float blurred = 0.f;
+                    for (int32_t dy = -1; dy <= 1; dy++) {
+                        for (int32_t dx = -1; dx <= 1; dx++) {
+                            int32_t u = clamp<int32_t>((int32_t)x + dx, 0, w - 1);
+                            int32_t v = clamp<int32_t>((int32_t)y + dy, 0, h - 1);
+                            blurred += KERNEL3[abs(dx)] * KERNEL3[abs(dy)] * var[u + v * w];
+                        }
+                    }
+                    float sigma_l = DENOISE_SIGMA_LUMINANCE * sqrtf(blurred) + 1e-4f;
+
+                    vec3_t sum = BLACK;
+                    float sum_var = 0.f;
+                    float sum_w = 0.f;
+                    for (int32_t dy = -2; dy <= 2; dy++) {
+                        for (int32_t dx = -2; dx <= 2; dx++) {
+                            int32_t u = (int32_t)x + dx * step;
+                            int32_t v = (int32_t)y + dy * step;
+                            if (u < 0 || v < 0 || u >= (int32_t)w || v >= (int32_t)h)
+                                continue;
+
+                            const pixel_features_t& fq = features[u + v * w];
+                            vec3_t cq = color[u + v * w];
+
+                            float depth_scale = fabsf(fp.depth_dx * dx + fp.depth_dy * dy) * step;
+                            float e = fabsf(lp - luminance(cq)) / sigma_l
+                                    + fabsf(fp.depth - fq.depth)
+                                    / (DENOISE_SIGMA_DEPTH * depth_scale + 1e-3f);
+                            float wn = powf(std::max(0.f, dot(fp.normal, fq.normal)),
+                                            DENOISE_SIGMA_NORMAL);
+                            float weight = dx || dy ? expf(-e) * wn : 1.f;
+                            float hw = KERNEL[abs(dx)] * KERNEL[abs(dy)] * weight;
+
+                            sum += cq * hw;
+                            sum_var += hw * hw * var[u + v * w];
+                            sum_w += hw;
+                        }
+                    }
+
+                    color_next[x + y * w] = sum / sum_w;
+                    var_next[x + y * w] = sum_var / (sum_w * sum_w);
+                }
+            });
+
+            std::swap(color, color_next);
+            std::swap(var, var_next);
+        }
+
+        parallel_rows(h, i.thread_count, [&](uint32_t y) {
+            for (uint32_t x = 0; x < w; x++) {
+                vec3_t albedo = features[x + y * w].albedo;
+                vec3_t c = color[x + y * w];
+                film_at(x, y) = vec3_t(albedo.r > 1e-3f ? c.r * albedo.r : c.r,
+                                       albedo.g > 1e-3f ? c.g * albedo.g : c.g,
+                                       albedo.b > 1e-3f ? c.b * albedo.b : c.b);
+            }
+        });
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "framework.hh"
+
+namespace RE
+{
+    // Filters the float film over `bounds` in place, along the edges of the
+    // depth, normal and albedo channels of `aovs`. `variance` holds the
+    // variance of each pixel mean's luminance; without one it is estimated
+    // from the neighbours.
+    void denoise(struct renderer_info& i, struct area bounds, vec3_t *film,
+                 const float *variance, const aov_film_t& aovs);
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <math.h>
+
+#include "film.hh"
+
+namespace RE
+{
+    const float GAUSSIAN_ALPHA = 2.f;
+
+    float filter_radius(pixel_filter_e f)
+    {
+        switch (f) {
+            case FILTER_BOX:
+                return 0.5f;
+            case FILTER_TENT:
+                return 1.f;
+            case FILTER_GAUSSIAN:
+                return 1.5f;
+            case FILTER_MITCHELL:
+                return 2.f;
+        }
+        return 0.5f;
+    }
+
+    // Mitchell-Netravali with B = C = 1/3, over [-2, 2]
+    static float mitchell(float x)
+    {
+        const float B = 1.f / 3.f;
+        const float C = 1.f / 3.f;
+
+        x = fabsf(x);
+        if (x < 1.f)
+            return ((12.f - 9.f * B - 6.f * C) * x * x * x
+                  + (-18.f + 12.f * B + 6.f * C) * x * x
+                  + (6.f - 2.f * B)) * (1.f / 6.f);
+        if (x < 2.f)
+            return ((-B - 6.f * C) * x * x * x + (6.f * B + 30.f * C) * x * x
+                  + (-12.f * B - 48.f * C) * x + (8.f * B + 24.f * C)) * (1.f / 6.f);
+        return 0.f;
+    }
+
+    static float filter_1d(pixel_filter_e f, float x)
+    {
+        float r = filter_radius(f);
+        switch (f) {
+            case FILTER_BOX:
+                return fabsf(x) <= r ? 1.f : 0.f;
+            case FILTER_TENT:
+                return std::max(0.f, r - fabsf(x));
+            case FILTER_GAUSSIAN:
+                // Shifted down so it reaches 0 at the radius
+                return std::max(0.f, expf(-GAUSSIAN_ALPHA * x * x)
+                                   - expf(-GAUSSIAN_ALPHA * r * r));
+            case FILTER_MITCHELL:
+                return mitchell(x);
+        }
+        return 0.f;
+    }
+
+    float filter_weight(pixel_filter_e f, float dx, float dy)
+    {
+        return filter_1d(f, dx) * filter_1d(f, dy);
+    }
+
+    void tile_film_init(tile_film_t& t, pixel_filter_e f, struct area tile)
+    {
+        int32_t border = ceilf(filter_radius(f));
+        t.x = (int32_t)tile.x - border;
+        t.y = (int32_t)tile.y - border;
+        t.w = tile.w + 2 * border;
+        t.h = tile.h + 2 * border;
+        t.color.assign(t.w * t.h, BLACK);
+        t.weight.assign(t.w * t.h, 0.f);
+    }
+
+    void tile_film_add(tile_film_t& t, pixel_filter_e f, float fx, float fy, vec3_t L)
+    {
+        // Pixels whose center (x + 0.5, y + 0.5) is within the radius
+        float r = filter_radius(f);
+        int32_t x0 = std::max<int32_t>(t.x, ceilf(fx - 0.5f - r));
+        int32_t y0 = std::max<int32_t>(t.y, ceilf(fy - 0.5f - r));
+        int32_t x1 = std::min<int32_t>(t.x + t.w - 1, floorf(fx - 0.5f + r));
+        int32_t y1 = std::min<int32_t>(t.y + t.h - 1, floorf(fy - 0.5f + r));
+
+        for (int32_t y = y0; y <= y1; y++) {
+            for (int32_t x = x0; x <= x1; x++) {
+                float w = filter_weight(f, x + 0.5f - fx, y + 0.5f - fy);
+                uint32_t p = (x - t.x) + (y - t.y) * t.w;
+                t.color[p] += L * w;
+                t.weight[p] += w;
+            }
+        }
+    }
+
+    void tile_film_merge(const tile_film_t& t, struct area bounds, uint32_t width,
+                         vec3_t *color, float *weight)
+    {
+        int32_t x0 = std::max<int32_t>(t.x, bounds.x);
+        int32_t y0 = std::max<int32_t>(t.y, bounds.y);
+        int32_t x1 = std::min<int32_t>(t.x + t.w, bounds.x + bounds.w);
+        int32_t y1 = std::min<int32_t>(t.y + t.h, bounds.y + bounds.h);
+
+        for (int32_t y = y0; y < y1; y++) {
+            for (int32_t x = x0; x < x1; x++) {
+                uint32_t p = (x - t.x) + (y - t.y) * t.w;
+                color[x + y * width] += t.color[p];
+                weight[x + y * width] += t.weight[p];
+            }
+        }
+    }
+
+    void film_resolve(const std::vector<tile_film_t>& tiles, struct area bounds,
+                      uint32_t width, uint32_t height, vec3_t *film)
+    {
+        std::vector<vec3_t> color(width * height, BLACK);
+        std::vector<float> weight(width * height, 0.f);
+        for (const tile_film_t& t : tiles)
+            tile_film_merge(t, bounds, width, color.data(), weight.data());
+
+        for (uint32_t y = bounds.y; y < bounds.y + bounds.h; y++) {
+            for (uint32_t x = bounds.x; x < bounds.x + bounds.w; x++) {
+                uint32_t p = x + y * width;
+                if (weight[p] > 0.f)
+                    film[p] = color[p] * (1.f / weight[p]);
+            }
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "types.hh"
+
+namespace RE
+{
+    typedef enum pixel_filter {
+        FILTER_BOX, FILTER_TENT, FILTER_GAUSSIAN, FILTER_MITCHELL
+    } pixel_filter_e;
+
+    // Pixels farther than this from a sample get nothing from it
+    float filter_radius(pixel_filter_e f);
+    // Weight of a sample (dx, dy) pixels away from a pixel center
+    float filter_weight(pixel_filter_e f, float dx, float dy);
+
+    // Weighted samples of one tile, spread over its border by the filter.
+    // Each tile has its own: threads never write to the same pixels.
+    typedef struct tile_film {
+        int32_t x, y; // Top left, border included
+        uint32_t w, h;
+        std::vector<vec3_t> color;
+        std::vector<float> weight;
+    } tile_film_t;
+
+    void tile_film_init(tile_film_t& t, pixel_filter_e f, struct area tile);
+    // Adds a sample taken at the film position (fx, fy)
+    void tile_film_add(tile_film_t& t, pixel_filter_e f, float fx, float fy, vec3_t L);
+    // Adds the sums of the tile to the frame ones, clipped to `bounds`
+    void tile_film_merge(const tile_film_t& t, struct area bounds, uint32_t width,
+                         vec3_t *color, float *weight);
+    // Merges the tiles and divides the sums by the weights over `bounds`.
+    // `film` comes in with the plain mean of each pixel's own samples, kept
+    // where the negative lobes of the filter leave no positive weight.
+    void film_resolve(const std::vector<tile_film_t>& tiles, struct area bounds,
+                      uint32_t width, uint32_t height, vec3_t *film);
+}
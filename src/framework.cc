@@ -1,75 +1,15 @@
 #include <assert.h>
 #include <chrono>
-#include <fstream>
-#include <queue>
-#include <stack>
 #include <stdio.h>
 #include <thread>
 
 #include "defines.hh"
 #include "framework.hh"
 #include "lodepng.hh"
-#include "renderer.hh"
-#include "scoped_timer.hh"
 #include "viewer.hh"
 
 namespace RE
 {
-    static vec3_t render_pixel(struct renderer_info& i, uint32_t x, uint32_t y)
-    {
-        ray_t r = get_ray_from_camera(i, x, y);
-#if defined(USE_MDT)
-        return mdt(i.scene, r);
-#elif defined(USE_RAYTRACER)
-        return raytrace(i.scene, r, 0);
-#elif defined(USE_PATHTRACER)
-        {
-            vec3_t out = BLACK;
-            for (uint32_t s = 0; s < PT_SAMPLES; s++)
-                out = out + pathtrace(i.scene, r) * (1.0f / PT_SAMPLES);
-            return saturate(out);
-        }
-#elif defined(USE_BIDIR_PATHTRACER)
-        {
-            vec3_t out = BLACK;
-            for (uint32_t s = 0; s < BDPT_SAMPLES; s++)
-                out = out + bidir_pathtrace(i.scene, r) * (1.0f / BDPT_SAMPLES);
-            return saturate(out);
-        }
-#else
-    #error "No rendering method selected"
-#endif
-    }
-
-    struct job {
-        uint32_t x, y, width;
-    };
-
-    static void worker(struct renderer_info& i, std::queue<struct job>& q, std::mutex& m)
-    {
-        while (!q.empty()) {
-            m.lock();
-            if (q.empty()) {
-                m.unlock();
-                return;
-            }
-
-            struct job j = q.front();
-            q.pop();
-            m.unlock();
-
-            uint32_t lim = std::min(i.width, j.x + j.width);
-            for (uint32_t x = j.x; x < lim; x++) {
-                vec3_t px = render_pixel(i, x, j.y);
-
-                i.output_frame[(x + j.y * i.width) * STRIDE + 0] = px.r * 255.0;
-                i.output_frame[(x + j.y * i.width) * STRIDE + 1] = px.g * 255.0;
-                i.output_frame[(x + j.y * i.width) * STRIDE + 2] = px.b * 255.0;
-                i.output_frame[(x + j.y * i.width) * STRIDE + 3] = 255;
-            }
-        }
-    }
-
     void render_scene(scene_t *scene, uint32_t width, uint32_t height,
                       struct area *area)
     {
@@ -84,33 +24,46 @@ namespace RE
 
         viewer_state = initialize_viewport(info);
 
-#if defined(USE_MDT) or defined(USE_BIDIR_PATHTRACER)
-        mdt_generate_irradiance_lights(scene);
+#if defined(USE_MDT)
+        info.integrator = integrator_e::MDT;
+#elif defined(USE_RAYTRACER)
+        info.integrator = integrator_e::RAYTRACER;
+#elif defined(USE_PATHTRACER)
+        info.integrator = integrator_e::PATHTRACER;
+        info.samples = PT_SAMPLES;
+#elif defined(USE_BIDIR_PATHTRACER)
+        info.integrator = integrator_e::BIDIR_PATHTRACER;
+        info.samples = BDPT_SAMPLES;
+#elif defined(USE_PHOTON_MAPPER)
+        info.integrator = integrator_e::PHOTON_MAPPER;
+        info.samples = PM_PASSES;
+#elif defined(USE_MLT)
+        info.integrator = integrator_e::MLT;
+        info.samples = MLT_SAMPLES;
+#else
+    #error "No rendering method selected"
+#endif
+        info.thread_count = MAX_THREADS;
+        info.seed = 1;
+        info.filter = PIXEL_FILTER;
+#if defined(DENOISE)
+        info.denoise = true;
+#endif
+#if defined(RENDER_AOVS)
+        aov_film_t aov_film;
+        info.aovs = AOV_ALL;
+        info.aov_film = &aov_film;
 #endif
 
-        std::queue<struct job> jobs;
-        std::vector<std::thread> threads(0);
-        std::mutex lock;
-
-        uint32_t x = area ? area->x : 0;
-        uint32_t w = area ? area->w : width;
-        for (uint32_t y = 0; y < height; y++) {
-            struct job j = { x, y, w };
-            if (!area || (area->y <= y && area->y + area->h > y))
-                jobs.push(j);
-        }
-
-        for (uint32_t i = 0; i < MAX_THREADS; i++)
-            threads.emplace_back(worker, std::ref(info), std::ref(jobs), std::ref(lock));
-
-        for (uint32_t i = 0; i < MAX_THREADS; i++)
-            threads[i].join();
-        
+        render_frame(info, area);
 
         std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 
         lodepng::encode("output.png", info.output_frame, info.width, info.height);
         puts("Output written to the disk");
+#if defined(RENDER_AOVS)
+        aov_save(aov_film, RENDER_AOVS);
+#endif
         delete[] info.output_frame;
     }
 }
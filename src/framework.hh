@@ -1,18 +1,41 @@
 #pragma once
 
 #include <stdint.h>
+#include "aov.hh"
+#include "film.hh"
+#include "heatmap.hh"
 #include "types.hh"
 #include "raytracing.hh"
 
 namespace RE
 {
+    typedef enum integrator {
+        RAYTRACER, PATHTRACER, BIDIR_PATHTRACER, MDT, PHOTON_MAPPER, MLT
+    } integrator_e;
+
     struct renderer_info {
         uint32_t width;
         uint32_t height;
         uint8_t *output_frame;
         scene_t *scene;
+        tile_cost_t *tile_costs;
+        vec3_t *film;
+        float *variance; // Of each pixel mean's luminance, only when denoising
+        aov_film_t *aov_film; // Receives the aovs channels, set when aovs is
+        photon_pixel_t *photon_pixels;
+        tile_film_t *tile_films; // One per tile, when the samples are filtered
+
+        integrator_e integrator;
+        uint32_t samples; // Passes for the photon mapper, mutations per pixel for MLT
+        uint32_t thread_count;
+        uint64_t seed;
+        bool denoise;
+        uint32_t aovs; // Mask of aov_bit()
+        pixel_filter_e filter; // Spreads the path tracer and BDPT samples
     };
 
+    // Renders into info.output_frame, no viewer involved. Returns the wall time.
+    float render_frame(struct renderer_info& info, struct area *render_area);
 
     void render_scene(scene_t *scene, uint32_t width, uint32_t height,
                       struct area *render_area);
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+
+#include "bvh.hh"
+#include "mapping.hh"
+#include "renderer.hh"
+#include "scoped_timer.hh"
+#include "stats.hh"
+
+// The primitives live in flat arrays per type. Bounded objects (spheres,
+// meshes, area lights) are reached through the top level hierarchy, the
+// triangles of a mesh through its own, whose leaves are triangle blocks.
+// The intersection functions return whether they found something closer
+// than *t, lowering *t to it. The hit record is only filled for the
+// closest primitive of all.
+
+namespace RE
+{
+    static void build_mesh(scene_geometry_t& g, object_mesh_t *m, uint32_t object,
+                           uint32_t thread_count)
+    {
+        std::vector<vec3_t> vtx(m->vtx_count);
+        std::vector<bbox_t> boxes(m->vtx_count / 3);
+        for (uint64_t i = 0; i < m->vtx_count; i++)
+            vtx[i] = rotate(m->vtx[i], m->rotation) + m->position;
+        for (uint64_t i = 0; i < m->vtx_count; i++) {
+            if (i % 3 == 0)
+                boxes[i / 3] = bbox_empty();
+            bbox_grow(boxes[i / 3], vtx[i]);
+        }
+
+        // One block per leaf
+        geometry_mesh_t mesh;
+        std::vector<uint32_t> order;
+        bvh_build(mesh.bvh, boxes, SIMD_WIDTH, SIMD_WIDTH, g.builder, thread_count, order);
+        if (g.layout == BVH_QUANTIZED && !bvh_quantize(mesh.bvh))
+            puts("Mesh too large for the quantized layout: tracing it wide");
+        mesh.first = g.triangles.object.size();
+        assert(mesh.first % SIMD_WIDTH == 0);
+
+        for (uint32_t k : order) {
+            if (k == NO_PRIMITIVE)
+                triangles_pad(g.triangles);
+            else
+                triangles_push(g.triangles, vtx[3 * k], vtx[3 * k + 1], vtx[3 * k + 2],
+                               object, 3 * k);
+        }
+        g.meshes.push_back(mesh);
+    }
+
+    void build_scene_geometry(scene_t *scene, uint32_t thread_count)
+    {
+        scene_geometry_t& g = scene->geometry;
+        bvh_layout_e layout = g.layout;
+        bvh_builder_e builder = g.builder;
+        g = scene_geometry_t();
+        g.layout = layout;
+        g.builder = builder;
+        scoped_timer_t timer(g.build_time);
+
+        std::vector<geometry_instance_t> instances;
+        std::vector<bbox_t> boxes;
+
+        for (uint32_t k = 0; k < scene->objects.size(); k++) {
+            object_t *o = scene->objects[k];
+
+            switch (o->type) {
+                case object_type_e::SPHERE:
+                {
+                    object_sphere_t *s = static_cast<object_sphere_t*>(o);
+                    vec3_t r(s->radius, s->radius, s->radius);
+                    instances.push_back({ INSTANCE_SPHERE, (uint32_t)g.spheres.object.size(), k });
+                    boxes.push_back({ s->position - r, s->position + r });
+                    spheres_push(g.spheres, s->position, s->radius, k);
+                    break;
+                }
+                case object_type_e::PLANE:
+                {
+                    object_plane_t *p = static_cast<object_plane_t*>(o);
+                    vec3_t n = normalize(rotate(p->normal, p->rotation));
+                    g.planes.nx.push_back(n.x);
+                    g.planes.ny.push_back(n.y);
+                    g.planes.nz.push_back(n.z);
+                    g.planes.offset.push_back(dot(n, p->position));
+                    g.planes.object.push_back(k);
+                    break;
+                }
+                case object_type_e::MESH:
+                {
+                    object_mesh_t *m = static_cast<object_mesh_t*>(o);
+                    assert(m->vtx_count > 0 && "An empty mesh is in the rendering system");
+                    assert(m->vtx_count % 3 == 0 && "Invalid vtx count. Must be multiple of 3");
+
+                    instances.push_back({ INSTANCE_MESH, (uint32_t)g.meshes.size(), k });
+                    build_mesh(g, m, k, thread_count);
+                    boxes.push_back(bvh_bounds(g.meshes.back().bvh));
+                    break;
+                }
+                case object_type_e::AREA_LIGHT:
+                {
+                    area_light_t *l = static_cast<area_light_t*>(o);
+                    vec3_t vt = area_light_extent(l);
+                    vec3_t half(fabsf(vt.x) * 0.5f, 0.0001f, fabsf(vt.z) * 0.5f);
+                    instances.push_back({ INSTANCE_QUAD, (uint32_t)g.quads.object.size(), k });
+                    boxes.push_back({ l->position - half, l->position + half });
+
+                    g.quads.cx.push_back(l->position.x);
+                    g.quads.cy.push_back(l->position.y);
+                    g.quads.cz.push_back(l->position.z);
+                    g.quads.half_x.push_back(half.x);
+                    g.quads.half_z.push_back(half.z);
+                    g.quads.ny.push_back(area_light_normal(l).y);
+                    g.quads.object.push_back(k);
+                    break;
+                }
+                default:
+                    assert(0 && "Object type unknown.");
+            }
+        }
+        spheres_pad(g.spheres);
+
+        if (instances.empty())
+            return;
+
+        std::vector<uint32_t> order;
+        bvh_build(g.top, boxes, 2, 1, g.builder, thread_count, order);
+        if (g.layout == BVH_QUANTIZED && !bvh_quantize(g.top))
+            puts("Scene too large for the quantized layout: tracing it wide");
+        for (uint32_t k : order)
+            g.instances.push_back(instances[k]);
+    }
+
+    static uint32_t closest_plane(const geometry_planes_t& p, const ray_t& r, float *t)
+    {
+        uint32_t found = NO_PRIMITIVE;
+        float best = *t;
+
+        for (uint32_t k = 0; k < p.object.size(); k++) {
+            float dn = p.nx[k] * r.direction.x + p.ny[k] * r.direction.y + p.nz[k] * r.direction.z;
+            float on = p.nx[k] * r.origin.x + p.ny[k] * r.origin.y + p.nz[k] * r.origin.z;
+            float d = (p.offset[k] - on) / dn;
+
+            bool closer = fabsf(dn) >= 0.0001f && d >= 0.f && d < best;
+            best = closer ? d : best;
+            found = closer ? k : found;
+        }
+
+        *t = best;
+        return found;
+    }
+
+    static bool intersect_quad_at(const geometry_quads_t& q, uint32_t k, const ray_t& r, float *t)
+    {
+        float d = (q.cy[k] - r.origin.y) / r.direction.y;
+        float x = r.origin.x + r.direction.x * d - q.cx[k];
+        float z = r.origin.z + r.direction.z * d - q.cz[k];
+
+        if (q.ny[k] * r.direction.y > -0.0001f || d < 0.f || d >= *t
+            || fabsf(x) > q.half_x[k] || fabsf(z) > q.half_z[k])
+            return false;
+        *t = d;
+        return true;
+    }
+
+    bool intersect_scene(scene_t *scene, ray_t ray, hit_t *out, ray_kind_e kind)
+    {
+        const scene_geometry_t& g = scene->geometry;
+
+        STATS_RAY(kind);
+        STATS_ADD(primitive_tests, g.planes.object.size());
+
+        ray.direction = normalize(ray.direction);
+        float t = std::numeric_limits<float>::infinity();
+        uint32_t plane = closest_plane(g.planes, ray, &t);
+
+#if defined(TRI_DOUBLE_SIDED)
+        bool double_sided = true;
+#else
+        bool double_sided = false;
+#endif
+        ray_shear_t shear = get_ray_shear(ray);
+        vec3_t barycentric;
+
+        // The last primitive to lower t is the closest. Exact ties between
+        // instances go to the lowest object (planes first), whatever order
+        // the hierarchy visits them in.
+        instance_kind_e closest = INSTANCE_SPHERE;
+        uint32_t found = NO_PRIMITIVE;
+        uint32_t winner = plane != NO_PRIMITIVE ? 0 : NO_PRIMITIVE;
+        bool tri_hit = false;
+
+        auto triangle_leaf = [&](const geometry_mesh_t& m, uint32_t index, uint32_t count) {
+            STATS_ADD(primitive_tests, count);
+            for (uint32_t k = m.first + index; k < m.first + index + count; k += SIMD_WIDTH) {
+                int32_t lane = intersect_tri_block(g.triangles.blocks[k / SIMD_WIDTH], shear,
+                                                   double_sided, &t, &barycentric);
+                if (lane >= 0) {
+                    tri_hit = true;
+                    found = k + lane;
+                }
+            }
+        };
+
+        auto instance_leaf = [&](uint32_t index, uint32_t count) {
+            for (uint32_t k = index; k < index + count; k++) {
+                const geometry_instance_t& inst = g.instances[k];
+                bool closer = false;
+                float limit = t;
+                if (inst.object < winner)
+                    t = nextafterf(t, std::numeric_limits<float>::infinity());
+
+                switch (inst.kind) {
+                    case INSTANCE_SPHERE:
+                        STATS_INC(primitive_tests);
+                        closer = intersect_sphere_at(g.spheres, inst.index, ray, &t);
+                        break;
+                    case INSTANCE_QUAD:
+                        STATS_INC(primitive_tests);
+                        closer = intersect_quad_at(g.quads, inst.index, ray, &t);
+                        break;
+                    case INSTANCE_MESH:
+                    {
+                        const geometry_mesh_t& m = g.meshes[inst.index];
+                        tri_hit = false;
+                        bvh_traverse(m.bvh, g.layout, ray, &t, [&](uint32_t i, uint32_t c) {
+                            triangle_leaf(m, i, c);
+                        });
+                        closer = tri_hit;
+                        break;
+                    }
+                }
+
+                if (closer) {
+                    closest = inst.kind;
+                    if (inst.kind != INSTANCE_MESH)
+                        found = inst.index;
+                    winner = inst.object;
+                }
+                else
+                    t = limit;
+            }
+        };
+
+        if (!g.instances.empty())
+            bvh_traverse(g.top, g.layout, ray, &t, instance_leaf);
+
+        hit_t hit;
+        hit.position = ray.origin + ray.direction * t;
+
+        if (found != NO_PRIMITIVE && closest == INSTANCE_QUAD) {
+            hit.normal = vec3_t(0.f, g.quads.ny[found], 0.f);
+            hit.object = scene->objects[g.quads.object[found]];
+        }
+        else if (found != NO_PRIMITIVE && closest == INSTANCE_MESH) {
+            const geometry_triangles_t& tri = g.triangles;
+            vec3_t a, b, c;
+            triangles_get(tri, found, &a, &b, &c);
+            object_mesh_t *m = static_cast<object_mesh_t*>(scene->objects[tri.object[found]]);
+
+            // Back faces, when they are hit, face the ray too
+            hit.normal = normalize(cross(b - a, c - a));
+            if (dot(hit.normal, ray.direction) > 0.f)
+                hit.normal = -hit.normal;
+            hit.uv_coord = get_triangle_uv(m->uv + tri.vertex[found], barycentric);
+            hit.object = m;
+        }
+        else if (found != NO_PRIMITIVE) {
+            vec3_t center(g.spheres.cx[found], g.spheres.cy[found], g.spheres.cz[found]);
+            hit.normal = normalize(hit.position - center);
+            hit.uv_coord = get_sphere_uv(center, hit.position);
+            hit.object = scene->objects[g.spheres.object[found]];
+        }
+        else if (plane != NO_PRIMITIVE) {
+            hit.normal = vec3_t(g.planes.nx[plane], g.planes.ny[plane], g.planes.nz[plane]);
+            hit.object = scene->objects[g.planes.object[plane]];
+        }
+        else
+            return false;
+
+        *out = hit;
+        return true;
+    }
+}
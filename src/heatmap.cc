@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <string>
+
+#include "defines.hh"
+#include "heatmap.hh"
+#include "helpers.hh"
+#include "lodepng.hh"
+#include "vectors.hh"
+
+namespace RE
+{
+    // Black -> blue -> red -> yellow -> white ramp, w in [0; 1]
+    static vec3_t false_color(float w)
+    {
+        const vec3_t ramp[] = {
+            BLACK,
+            vec3_t(0.1f, 0.1f, 0.8f),
+            vec3_t(0.9f, 0.1f, 0.1f),
+            vec3_t(1.0f, 0.9f, 0.1f),
+            WHITE,
+        };
+        const uint32_t steps = sizeof(ramp) / sizeof(ramp[0]) - 1;
+
+        w = clamp(w, 0.f, 1.f) * steps;
+        uint32_t i = std::min((uint32_t)w, steps - 1);
+        return lerp(ramp[i], ramp[i + 1], w - i);
+    }
+
+    void heatmap_write(const char *prefix, const std::vector<tile_cost_t>& tiles,
+                       uint32_t width, uint32_t height)
+    {
+        float max_time = 0.f;
+        for (const tile_cost_t& t : tiles)
+            max_time = std::max(max_time, t.time);
+
+        std::vector<uint8_t> image(width * height * STRIDE, 0);
+        for (const tile_cost_t& t : tiles) {
+            vec3_t c = false_color(max_time > 0.f ? t.time / max_time : 0.f);
+
+            for (uint32_t y = t.y; y < std::min(height, t.y + t.h); y++) {
+                for (uint32_t x = t.x; x < std::min(width, t.x + t.w); x++) {
+                    image[(x + y * width) * STRIDE + 0] = c.r * 255.0;
+                    image[(x + y * width) * STRIDE + 1] = c.g * 255.0;
+                    image[(x + y * width) * STRIDE + 2] = c.b * 255.0;
+                    image[(x + y * width) * STRIDE + 3] = 255;
+                }
+            }
+        }
+
+        std::string png = std::string(prefix) + ".png";
+        lodepng::encode(png, image, width, height);
+
+        std::string csv = std::string(prefix) + ".csv";
+        std::ofstream out(csv);
+        if (!out) {
+            fprintf(stderr, "Unable to write %s\n", csv.c_str());
+            return;
+        }
+
+        out << "x,y,w,h,time,rays,rays_per_sec\n";
+        for (const tile_cost_t& t : tiles) {
+            out << t.x << "," << t.y << "," << t.w << "," << t.h << ","
+                << t.time << "," << t.rays << ","
+                << (t.time > 0.f ? t.rays / t.time : 0.f) << "\n";
+        }
+
+        printf("Heatmap written to %s and %s\n", png.c_str(), csv.c_str());
+    }
+}
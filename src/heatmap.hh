@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace RE
+{
+    typedef struct tile_cost {
+        uint32_t x, y, w, h;
+        float time;
+        uint64_t rays;
+    } tile_cost_t;
+
+    // Writes <prefix>.png (false-color render time per tile) and <prefix>.csv
+    void heatmap_write(const char *prefix, const std::vector<tile_cost_t>& tiles,
+                       uint32_t width, uint32_t height);
+}
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <math.h>
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
 
 #define D_EPSYLON 0.00001
 #define F_EPSYLON 0.001f
@@ -24,3 +31,52 @@ T is_zero(T v)
 {
     return v < static_cast<T>(F_EPSYLON) && v > - static_cast<T>(D_EPSYLON);
 }
+
+// For std::vector of types laid out on cache lines
+template<typename T, size_t Align>
+struct aligned_allocator {
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef aligned_allocator<U, Align> other;
+    };
+
+    aligned_allocator() = default;
+    template<typename U>
+    aligned_allocator(const aligned_allocator<U, Align>&) { }
+
+    T *allocate(size_t n)
+    {
+        void *p = nullptr;
+        if (posix_memalign(&p, Align, n * sizeof(T)))
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        free(p);
+    }
+
+    bool operator==(const aligned_allocator&) const { return true; }
+    bool operator!=(const aligned_allocator&) const { return false; }
+};
+
+// Runs work(row) over `rows` rows, spread over the threads
+template<typename F>
+void parallel_rows(uint32_t rows, uint32_t thread_count, F work)
+{
+    std::atomic<uint32_t> next(0);
+    std::vector<std::thread> threads;
+
+    auto loop = [&]() {
+        for (uint32_t r = next++; r < rows; r = next++)
+            work(r);
+    };
+
+    for (uint32_t t = 0; t < std::max(1u, thread_count); t++)
+        threads.emplace_back(loop);
+    for (std::thread& t : threads)
+        t.join();
+}
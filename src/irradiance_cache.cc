@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+#include <vector>
+
+#include "defines.hh"
+#include "helpers.hh"
+#include "renderer.hh"
+#include "stats.hh"
+
+// Irradiance caching (Ward et al. 1988, gradients from Ward & Heckbert 1992).
+// Indirect irradiance is computed at sparse records by stratified hemisphere
+// sampling and interpolated elsewhere, corrected by its rotational and
+// translational gradients. Records live in an octree: a record is stored in
+// every node its validity region overlaps, at the level where nodes are
+// about its size, so a lookup only walks down to the leaf holding the point.
+//
+// The cache is filled before the render, in rounds over sparser to denser
+// pixel grids. Within a round the cache is read-only and every record is
+// computed with its own random stream; new records are inserted in pixel
+// order once the round is over, so the cache only depends on the seed.
+
+#if defined(PT_IRRADIANCE_CACHE)
+namespace RE
+{
+    const uint32_t IC_MAX_OCTREE_DEPTH = 16;
+
+    static float channel(vec3_t v, uint32_t c)
+    {
+        return c == 0 ? v.r : (c == 1 ? v.g : v.b);
+    }
+
+    static ic_record_t compute_record(scene_t *scene, vec3_t p, vec3_t n)
+    {
+        const uint32_t M = IC_THETA_SAMPLES;
+        const uint32_t N = IC_PHI_SAMPLES;
+        std::vector<vec3_t> radiance(M * N);
+        std::vector<float> dist(M * N);
+
+        vec3_t u = normalize(cross(fabs(n.x) > 0.1f ? VECTOR_UP : VECTOR_RIGHT, n));
+        vec3_t v = cross(n, u);
+
+        ic_record_t rec = ic_record_t();
+        rec.position = p;
+        rec.normal = n;
+
+        // Cosine-distributed strata: j splits sin^2(theta), k splits phi
+        float inv_dist_sum = 0.f;
+        for (uint32_t k = 0; k < N; k++) {
+            vec3_t tan_sum = BLACK;
+
+            for (uint32_t j = 0; j < M; j++) {
+                float s2 = (j + rand_0_1()) / M;
+                float phi = 2.f * PI * (k + rand_0_1()) / N;
+                float sin_t = sqrtf(s2);
+                float cos_t = sqrtf(1.f - s2);
+
+                ray_t r;
+                r.origin = p + n * F_EPSYLON;
+                r.direction = (u * cosf(phi) + v * sinf(phi)) * sin_t + n * cos_t;
+
+                hit_t hit;
+                float d = std::numeric_limits<float>::infinity();
+                vec3_t l = BLACK;
+                if (intersect_scene(scene, r, &hit, RAY_BOUNCE)) {
+                    d = magnitude(hit.position - r.origin);
+                    // Emitters seen from here are direct light, sampled apart
+                    if (hit.object->type != object_type_e::AREA_LIGHT)
+                        l = pathtrace(scene, r);
+                }
+
+                radiance[j * N + k] = l;
+                dist[j * N + k] = d;
+                inv_dist_sum += 1.f / d;
+                rec.irradiance += l;
+                tan_sum += l * (-sin_t / std::max(cos_t, 1e-3f));
+            }
+
+            float phi_c = 2.f * PI * (k + 0.5f) / N;
+            vec3_t v_k = u * -sinf(phi_c) + v * cosf(phi_c);
+            for (uint32_t c = 0; c < 3; c++)
+                rec.rot_gradient[c] += v_k * (channel(tan_sum, c) * PI / (M * N));
+        }
+        rec.irradiance *= PI / (M * N);
+
+        // Translational gradient: change of the strata borders when moving
+        // in the tangent plane, weighted by the closest of both distances.
+        // Hits right next to p (in corners) would make it blow up.
+        for (uint32_t k = 0; k < N; k++) {
+            float phi_c = 2.f * PI * (k + 0.5f) / N;
+            float phi_m = 2.f * PI * k / N;
+            vec3_t u_k = u * cosf(phi_c) + v * sinf(phi_c);
+            vec3_t v_k = u * -sinf(phi_m) + v * cosf(phi_m);
+            uint32_t k_prev = (k + N - 1) % N;
+
+            for (uint32_t j = 0; j < M; j++) {
+                uint32_t id = j * N + k;
+
+                if (j > 0) {
+                    float s2 = (float)j / M;
+                    float coef = 2.f * PI / N * sqrtf(s2) * (1.f - s2)
+                               / std::max(std::min(dist[id], dist[id - N]), IC_MIN_RADIUS);
+                    vec3_t dl = radiance[id] - radiance[id - N];
+                    for (uint32_t c = 0; c < 3; c++)
+                        rec.trans_gradient[c] += u_k * (coef * channel(dl, c));
+                }
+
+                float coef = (sqrtf((j + 1.f) / M) - sqrtf((float)j / M))
+                           / std::max(std::min(dist[id], dist[j * N + k_prev]), IC_MIN_RADIUS);
+                vec3_t dl = radiance[id] - radiance[j * N + k_prev];
+                for (uint32_t c = 0; c < 3; c++)
+                    rec.trans_gradient[c] += v_k * (coef * channel(dl, c));
+            }
+        }
+
+        // Harmonic mean distance, kept short enough for the gradient not to
+        // extrapolate past zero within the record.
+        float radius = inv_dist_sum > 0.f ? (M * N) / inv_dist_sum : IC_MAX_RADIUS;
+        for (uint32_t c = 0; c < 3; c++) {
+            float g = magnitude(rec.trans_gradient[c]);
+            if (g > 0.f)
+                radius = std::min(radius, channel(rec.irradiance, c) / g);
+        }
+        rec.radius = clamp(radius, IC_MIN_RADIUS, IC_MAX_RADIUS);
+        return rec;
+    }
+
+    static void octree_insert(irradiance_cache_t& cache, uint32_t node, uint32_t id,
+                              vec3_t bb_min, vec3_t bb_max, uint32_t depth)
+    {
+        vec3_t center = cache.nodes[node].center;
+        float half = cache.nodes[node].half_size;
+
+        if (depth == IC_MAX_OCTREE_DEPTH || 2.f * half < magnitude(bb_max - bb_min)) {
+            cache.nodes[node].records.push_back(id);
+            return;
+        }
+
+        for (uint32_t c = 0; c < 8; c++) {
+            vec3_t offset((c & 1) ? 0.5f : -0.5f, (c & 2) ? 0.5f : -0.5f, (c & 4) ? 0.5f : -0.5f);
+            vec3_t child_center = center + offset * half;
+            float child_half = half * 0.5f;
+
+            if (bb_max.x < child_center.x - child_half || bb_min.x > child_center.x + child_half
+                || bb_max.y < child_center.y - child_half || bb_min.y > child_center.y + child_half
+                || bb_max.z < child_center.z - child_half || bb_min.z > child_center.z + child_half)
+                continue;
+
+            // Nodes are only referred to by index: push_back may reallocate
+            if (!cache.nodes[node].children[c]) {
+                ic_node_t child = ic_node_t();
+                child.center = child_center;
+                child.half_size = child_half;
+                cache.nodes.push_back(child);
+                cache.nodes[node].children[c] = cache.nodes.size() - 1;
+            }
+            octree_insert(cache, cache.nodes[node].children[c], id, bb_min, bb_max, depth + 1);
+        }
+    }
+
+    static void insert_record(irradiance_cache_t& cache, const ic_record_t& rec)
+    {
+        // Region where the record passes the error test, normals aside
+        vec3_t extent = WHITE * (rec.radius * IC_ERROR);
+
+        cache.records.push_back(rec);
+        octree_insert(cache, 0, cache.records.size() - 1, rec.position - extent,
+                      rec.position + extent, 0);
+    }
+
+    bool irradiance_cache_lookup(const irradiance_cache_t& cache, vec3_t p, vec3_t n,
+                                 vec3_t *irradiance)
+    {
+        if (cache.nodes.empty())
+            return false;
+
+        vec3_t sum = BLACK;
+        float weight = 0.f;
+        uint32_t node = 0;
+
+        while (true) {
+            const ic_node_t& cur = cache.nodes[node];
+
+            for (uint32_t id : cur.records) {
+                const ic_record_t& rec = cache.records[id];
+                vec3_t d = p - rec.position;
+
+                // Records in front of p do not see the same surroundings
+                if (dot(d, (n + rec.normal) * 0.5f) < -0.01f * rec.radius)
+                    continue;
+
+                float err = magnitude(d) / rec.radius
+                          + sqrtf(std::max(0.f, 1.f - dot(n, rec.normal)));
+                if (err >= IC_ERROR)
+                    continue;
+
+                // Falls to zero at the validity border: no seams
+                float w = 1.f / std::max(err, 1e-3f) - 1.f / IC_ERROR;
+                vec3_t rot = cross(rec.normal, n);
+                vec3_t e = rec.irradiance
+                         + vec3_t(dot(rot, rec.rot_gradient[0]) + dot(d, rec.trans_gradient[0]),
+                                  dot(rot, rec.rot_gradient[1]) + dot(d, rec.trans_gradient[1]),
+                                  dot(rot, rec.rot_gradient[2]) + dot(d, rec.trans_gradient[2]));
+                e = vec3_t(std::max(e.r, 0.f), std::max(e.g, 0.f), std::max(e.b, 0.f));
+
+                sum += e * w;
+                weight += w;
+            }
+
+            uint32_t c = (p.x > cur.center.x ? 1 : 0) | (p.y > cur.center.y ? 2 : 0)
+                       | (p.z > cur.center.z ? 4 : 0);
+            if (!cur.children[c])
+                break;
+            node = cur.children[c];
+        }
+
+        if (weight <= 0.f)
+            return false;
+
+        *irradiance = sum * (1.f / weight);
+        return true;
+    }
+
+    typedef struct ic_hit {
+        vec3_t position;
+        vec3_t normal;
+        bool valid;
+    } ic_hit_t;
+
+    void irradiance_cache_build(struct renderer_info& i, struct area bounds)
+    {
+        scene_t *scene = i.scene;
+        irradiance_cache_t& cache = scene->irradiance_cache;
+        cache = irradiance_cache_t();
+
+        // The pinhole rays never change: their hits are the shading points
+        std::vector<ic_hit_t> hits(bounds.w * bounds.h);
+        vec3_t bb_min = WHITE * std::numeric_limits<float>::infinity();
+        vec3_t bb_max = -bb_min;
+        for (uint32_t y = 0; y < bounds.h; y++) {
+            for (uint32_t x = 0; x < bounds.w; x++) {
+                ray_t r = get_ray_from_camera(i, bounds.x + x, bounds.y + y);
+                ic_hit_t& h = hits[x + y * bounds.w];
+                hit_t hit;
+
+                h.valid = intersect_scene(scene, r, &hit, RAY_PRIMARY)
+                       && hit.object->type != object_type_e::AREA_LIGHT;
+                if (!h.valid)
+                    continue;
+
+                h.position = hit.position;
+                h.normal = dot(hit.normal, r.direction) < 0.f ? hit.normal : -hit.normal;
+                bb_min = vec3_t(std::min(bb_min.x, h.position.x), std::min(bb_min.y, h.position.y),
+                                std::min(bb_min.z, h.position.z));
+                bb_max = vec3_t(std::max(bb_max.x, h.position.x), std::max(bb_max.y, h.position.y),
+                                std::max(bb_max.z, h.position.z));
+            }
+        }
+        if (bb_min.x > bb_max.x)
+            return;
+
+        vec3_t extent = bb_max - bb_min;
+        ic_node_t root = ic_node_t();
+        root.center = (bb_min + bb_max) * 0.5f;
+        root.half_size = std::max(extent.x, std::max(extent.y, extent.z)) * 0.5f + F_EPSYLON;
+        cache.nodes.push_back(root);
+
+        for (uint32_t stride = IC_FIRST_STRIDE; stride > 0; stride /= 2) {
+            std::vector<uint32_t> candidates;
+            for (uint32_t y = 0; y < bounds.h; y += stride) {
+                for (uint32_t x = 0; x < bounds.w; x += stride) {
+                    if (hits[x + y * bounds.w].valid)
+                        candidates.push_back(x + y * bounds.w);
+                }
+            }
+
+            std::vector<ic_record_t> created(candidates.size());
+            std::vector<uint8_t> needed(candidates.size(), 0);
+            parallel_rows(candidates.size(), i.thread_count, [&](uint32_t c) {
+                const ic_hit_t& h = hits[candidates[c]];
+                vec3_t e;
+                if (irradiance_cache_lookup(cache, h.position, h.normal, &e))
+                    return;
+
+                seed_random(i.seed ^ ((candidates[c] + 1) * 0x9e3779b97f4a7c15ULL));
+                created[c] = compute_record(scene, h.position, h.normal);
+                needed[c] = 1;
+            });
+
+            for (uint32_t c = 0; c < candidates.size(); c++) {
+                if (needed[c])
+                    insert_record(cache, created[c]);
+            }
+        }
+
+        printf("Irradiance cache: %zu records\n", cache.records.size());
+    }
+}
+#endif
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <vector>
+
+#include "defines.hh"
+#include "renderer.hh"
+
+// Lightcuts over the MDT lights (Walter et al. 2005). The lights are grouped
+// in a binary tree; a node stands for all the lights below it through one
+// representative light, picked proportionally to intensity, and carries the
+// summed intensity and bounding box of its lights.
+//
+// A cut is grown from the root by refining the node with the largest error
+// bound until every bound falls under MDT_LIGHTCUTS_ERROR of the running
+// estimate. The MDT gather only weights lights by visibility, so a node's
+// error is bounded by its intensity, or zero when its box lies entirely
+// behind the shading point.
+
+namespace RE
+{
+    static float intensity_bound(vec3_t c)
+    {
+        return std::max(c.r, std::max(c.g, c.b));
+    }
+
+    static uint32_t build_node(scene_t *scene, std::vector<uint32_t>& ids,
+                               uint32_t begin, uint32_t end)
+    {
+        std::vector<light_node_t>& tree = scene->mdt_light_tree;
+        uint32_t id = tree.size();
+        tree.push_back(light_node_t());
+
+        if (end - begin == 1) {
+            const light_t& l = scene->mdt_lights[ids[begin]];
+            light_node_t& leaf = tree[id];
+
+            leaf.bb_min = l.position;
+            leaf.bb_max = l.position;
+            leaf.intensity = l.mlt.emission * (1.f / scene->mdt_lights.size());
+            leaf.representative = ids[begin];
+            return id;
+        }
+
+        // Median split along the largest extent
+        vec3_t bb_min = scene->mdt_lights[ids[begin]].position;
+        vec3_t bb_max = bb_min;
+        for (uint32_t i = begin + 1; i < end; i++) {
+            vec3_t p = scene->mdt_lights[ids[i]].position;
+            bb_min = vec3_t(std::min(bb_min.x, p.x), std::min(bb_min.y, p.y), std::min(bb_min.z, p.z));
+            bb_max = vec3_t(std::max(bb_max.x, p.x), std::max(bb_max.y, p.y), std::max(bb_max.z, p.z));
+        }
+
+        vec3_t extent = bb_max - bb_min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        uint32_t mid = (begin + end) / 2;
+        std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+                         [&](uint32_t a, uint32_t b) {
+                             return scene->mdt_lights[a].position[axis]
+                                  < scene->mdt_lights[b].position[axis];
+                         });
+
+        uint32_t left = build_node(scene, ids, begin, mid);
+        uint32_t right = build_node(scene, ids, mid, end);
+
+        // Children were pushed after this node: only index into tree now
+        light_node_t& n = tree[id];
+        const light_node_t& l = tree[left];
+        const light_node_t& r = tree[right];
+        float il = intensity_bound(l.intensity);
+        float ir = intensity_bound(r.intensity);
+
+        n.bb_min = bb_min;
+        n.bb_max = bb_max;
+        n.intensity = l.intensity + r.intensity;
+        n.representative = rand_0_1() * (il + ir) < il ? l.representative : r.representative;
+        n.left = left;
+        n.right = right;
+        return id;
+    }
+
+    void lightcuts_build(scene_t *scene)
+    {
+        scene->mdt_light_tree.clear();
+        if (scene->mdt_lights.empty())
+            return;
+
+        std::vector<uint32_t> ids(scene->mdt_lights.size());
+        for (uint32_t i = 0; i < ids.size(); i++)
+            ids[i] = i;
+
+        scene->mdt_light_tree.reserve(2 * ids.size() - 1);
+        build_node(scene, ids, 0, ids.size());
+    }
+
+    // True when no point of the node's box is in front of the surface
+    static bool behind(const light_node_t& n, vec3_t position, vec3_t normal)
+    {
+        vec3_t far(normal.x > 0.f ? n.bb_max.x : n.bb_min.x,
+                   normal.y > 0.f ? n.bb_max.y : n.bb_min.y,
+                   normal.z > 0.f ? n.bb_max.z : n.bb_min.z);
+        return dot(far - position, normal) <= 0.f;
+    }
+
+    typedef struct cut_entry {
+        float bound;
+        uint32_t node;
+        bool visible;
+    } cut_entry_t;
+
+    static bool operator<(const cut_entry_t& a, const cut_entry_t& b)
+    {
+        return a.bound < b.bound;
+    }
+
+    vec3_t lightcuts_gather(scene_t *scene, vec3_t position, vec3_t normal)
+    {
+        const std::vector<light_node_t>& tree = scene->mdt_light_tree;
+        if (tree.empty() || behind(tree[0], position, normal))
+            return BLACK;
+
+        auto evaluate = [&](uint32_t id) {
+            const light_node_t& n = tree[id];
+            return mdt_light_visible(scene, position, scene->mdt_lights[n.representative].position);
+        };
+
+        std::vector<cut_entry_t> cut;
+        vec3_t estimate = BLACK;
+        uint32_t cut_size = 1;
+
+        bool root_visible = evaluate(0);
+        if (root_visible)
+            estimate = tree[0].intensity;
+        cut.push_back({ intensity_bound(tree[0].intensity), 0, root_visible });
+
+        while (!cut.empty() && cut_size < MDT_LIGHTCUTS_MAX_CUT) {
+            std::pop_heap(cut.begin(), cut.end());
+            cut_entry_t e = cut.back();
+
+            if (e.bound <= MDT_LIGHTCUTS_ERROR * intensity_bound(estimate))
+                break;
+            cut.pop_back();
+
+            const light_node_t& n = tree[e.node];
+            if (e.visible)
+                estimate -= n.intensity;
+
+            // Replace the node by its children; the one sharing the
+            // representative reuses its visibility.
+            for (uint32_t child : { n.left, n.right }) {
+                const light_node_t& c = tree[child];
+                if (behind(c, position, normal))
+                    continue;
+
+                bool visible = c.representative == n.representative ? e.visible : evaluate(child);
+                if (visible)
+                    estimate += c.intensity;
+
+                // Leaves are exact: they never need refining
+                if (c.left || c.right) {
+                    cut.push_back({ intensity_bound(c.intensity), child, visible });
+                    std::push_heap(cut.begin(), cut.end());
+                }
+            }
+            cut_size++;
+        }
+
+        return estimate;
+    }
+}
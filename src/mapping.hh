@@ -9,6 +9,7 @@ namespace RE
 {
     vec3_t get_diffuse_color(scene_t *scene, hit_t& hit);
 
-    vec3_t get_triangle_uv(vec3_t vtx[3], vec3_t uv[3], vec3_t pt);
+    // From the weights of the corners, as intersect_triangles gives them
+    vec3_t get_triangle_uv(const vec3_t uv[3], vec3_t barycentric);
     vec3_t get_sphere_uv(vec3_t center, vec3_t pt);
 }
@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+#include "defines.hh"
+#include "helpers.hh"
+#include "renderer.hh"
+#include "scoped_timer.hh"
+#include "stats.hh"
+
+// Primary sample space Metropolis light transport (Kelemen et al. 2002).
+// A path is a function of the uniform numbers its sampler reads: the
+// Markov chains mutate those numbers instead of the path vertices, so the
+// path tracer (or the bidirectional one) runs unchanged, its rand_0_1()
+// calls being served by the chain.
+//
+// Samples are read lazily (as in pbrt-v3): a number only gets its pending
+// mutations when a path asks for it, and the ones the last path did not
+// reach are left alone.
+//
+// The chains visit paths proportionally to their luminance; the image is
+// rescaled by the mean luminance, estimated over MLT_BOOTSTRAP independent
+// paths whose samples also seed the chains.
+
+namespace RE
+{
+    const uint32_t BOOTSTRAP_PER_JOB = 1024;
+
+    typedef struct primary_sample {
+        float value;
+        float backup;
+        uint64_t modified; // Iteration of the last change
+        uint64_t backup_modified;
+    } primary_sample_t;
+
+    typedef struct mlt_sampler {
+        std::vector<primary_sample_t> u;
+        uint64_t rng;
+        uint64_t iteration;
+        uint64_t last_large_step;
+        bool large_step;
+        uint32_t next; // Next number read by the path
+    } mlt_sampler_t;
+
+    // A path: what it adds to each pixel, already divided by the density
+    // of its pixel, and its luminance.
+    typedef struct mlt_path {
+        std::vector<splat_t> splats;
+        float f;
+    } mlt_path_t;
+
+    static void sampler_init(mlt_sampler_t& s, uint64_t seed)
+    {
+        s.u.clear();
+        s.rng = random_state(seed);
+        s.iteration = 0;
+        s.last_large_step = 0;
+        s.large_step = true;
+        s.next = 0;
+    }
+
+    static float sampler_next(void *data)
+    {
+        mlt_sampler_t& s = *static_cast<mlt_sampler_t*>(data);
+        // A number no path has read yet is uniform, as if it was drawn at
+        // the last large step. Mutating a default 0 would bias the paths
+        // that get longer than before.
+        if (s.next >= s.u.size()) {
+            primary_sample_t fresh = primary_sample_t();
+            fresh.value = rand_0_1(s.rng);
+            fresh.modified = s.last_large_step;
+            s.u.push_back(fresh);
+        }
+
+        primary_sample_t& x = s.u[s.next++];
+
+        // Not read since the last large step: it was replaced then
+        if (x.modified < s.last_large_step) {
+            x.value = rand_0_1(s.rng);
+            x.modified = s.last_large_step;
+        }
+
+        x.backup = x.value;
+        x.backup_modified = x.modified;
+
+        if (s.large_step)
+            x.value = rand_0_1(s.rng);
+        else {
+            // The pending small steps at once: their sum is a single
+            // normal step with sqrt(n) times the deviation.
+            float n = s.iteration - x.modified;
+            float u1 = 1.f - rand_0_1(s.rng);
+            float u2 = rand_0_1(s.rng);
+            float normal = sqrtf(-2.f * logf(u1)) * cosf(2.f * PI * u2);
+
+            x.value += normal * MLT_SIGMA * sqrtf(n);
+            x.value -= floorf(x.value);
+        }
+
+        x.modified = s.iteration;
+        return x.value;
+    }
+
+    static void sampler_start(mlt_sampler_t& s)
+    {
+        s.iteration++;
+        s.large_step = rand_0_1(s.rng) < MLT_LARGE_STEP;
+        s.next = 0;
+    }
+
+    static void sampler_accept(mlt_sampler_t& s)
+    {
+        if (s.large_step)
+            s.last_large_step = s.iteration;
+    }
+
+    static void sampler_reject(mlt_sampler_t& s)
+    {
+        for (primary_sample_t& x : s.u) {
+            if (x.modified == s.iteration) {
+                x.value = x.backup;
+                x.modified = x.backup_modified;
+            }
+        }
+        s.iteration--;
+    }
+
+    static void sample_path(struct renderer_info& i, struct area bounds, mlt_sampler_t& s,
+                            mlt_path_t& path)
+    {
+        path.splats.clear();
+        path.f = 0.f;
+
+        // The pixel is part of the path, so it mutates too
+        set_random_source(sampler_next, &s);
+        float fx = rand_0_1() * bounds.w;
+        float fy = rand_0_1() * bounds.h;
+        uint32_t x = bounds.x + std::min<uint32_t>(bounds.w - 1, fx);
+        uint32_t y = bounds.y + std::min<uint32_t>(bounds.h - 1, fy);
+        ray_t r = get_ray_from_film(i, bounds.x + fx, bounds.y + fy);
+        float pixels = bounds.w * bounds.h;
+
+#if defined(MLT_BIDIR)
+        // Light tracing estimates are normalized over the whole frame
+        vec3_t L = bidir_pathtrace(i, r, path.splats, nullptr);
+        for (splat_t& sp : path.splats)
+            sp.value *= i.width * i.height;
+#else
+        vec3_t L = pathtrace(i.scene, r);
+#endif
+        set_random_source(nullptr, nullptr);
+
+        path.splats.push_back({ x + y * i.width, L * pixels });
+        for (const splat_t& sp : path.splats)
+            path.f += luminance(sp.value);
+    }
+
+    static void splat_path(const mlt_path_t& path, float weight, vec3_t *film)
+    {
+        if (weight <= 0.f)
+            return;
+        for (const splat_t& sp : path.splats)
+            film[sp.pixel] += sp.value * weight;
+    }
+
+    static uint64_t bootstrap_seed(uint64_t seed, uint32_t k)
+    {
+        return seed ^ ((k + 1) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    static void run_chain(struct renderer_info& i, struct area bounds,
+                          const alias_table_t& starts, uint32_t chain,
+                          uint64_t mutations, vec3_t *film)
+    {
+        uint64_t rng = random_state(i.seed ^ (chain * 0xbf58476d1ce4e5b9ULL));
+        uint32_t start = alias_table_sample(starts, rand_0_1(rng));
+
+        // Replays the bootstrap path: same seed, first step is a large one
+        mlt_sampler_t s;
+        mlt_path_t current;
+        mlt_path_t proposed;
+        sampler_init(s, bootstrap_seed(i.seed, start));
+        sample_path(i, bounds, s, current);
+
+        for (uint64_t m = 0; m < mutations; m++) {
+            sampler_start(s);
+            sample_path(i, bounds, s, proposed);
+
+            float a = current.f > 0.f ? std::min(1.f, proposed.f / current.f) : 1.f;
+
+            // Expected values: both paths contribute, weighted by the
+            // acceptance probability.
+            if (proposed.f > 0.f)
+                splat_path(proposed, a / proposed.f, film);
+            if (current.f > 0.f)
+                splat_path(current, (1.f - a) / current.f, film);
+
+            if (rand_0_1(s.rng) < a) {
+                sampler_accept(s);
+                std::swap(current, proposed);
+            }
+            else
+                sampler_reject(s);
+        }
+    }
+
+    void mlt_render(struct renderer_info& i, struct area bounds,
+                    std::vector<render_stats_t>& stats)
+    {
+        uint32_t thread_count = i.thread_count;
+        std::vector<std::thread> threads;
+        std::atomic<uint32_t> next_job(0);
+
+        // Bootstrap, with the usual seeded jobs
+        std::vector<float> weights(MLT_BOOTSTRAP);
+        uint32_t job_count = (MLT_BOOTSTRAP + BOOTSTRAP_PER_JOB - 1) / BOOTSTRAP_PER_JOB;
+
+        auto bootstrap = [&](render_stats_t& out) {
+            thread_stats = render_stats_t();
+            {
+                scoped_timer_t timer(thread_stats.busy_time);
+                mlt_sampler_t s;
+                mlt_path_t path;
+
+                for (uint32_t j = next_job++; j < job_count; j = next_job++) {
+                    uint32_t end = std::min<uint32_t>(MLT_BOOTSTRAP, (j + 1) * BOOTSTRAP_PER_JOB);
+                    for (uint32_t k = j * BOOTSTRAP_PER_JOB; k < end; k++) {
+                        sampler_init(s, bootstrap_seed(i.seed, k));
+                        sample_path(i, bounds, s, path);
+                        weights[k] = path.f;
+                    }
+                }
+            }
+            stats_merge(out, thread_stats);
+        };
+
+        for (uint32_t t = 0; t < thread_count; t++)
+            threads.emplace_back(bootstrap, std::ref(stats[t]));
+        for (std::thread& t : threads)
+            t.join();
+        threads.clear();
+
+        double b = 0.;
+        for (float w : weights)
+            b += w;
+        b /= MLT_BOOTSTRAP;
+        if (b <= 0.)
+            return;
+
+        alias_table_t starts;
+        alias_table_build(starts, weights);
+
+        // Chains, a fixed number of them so the image does not depend on
+        // the thread count. Each thread splats in its own buffer.
+        uint64_t mutations = (uint64_t)i.samples * bounds.w * bounds.h;
+        std::vector<std::vector<vec3_t>> films(thread_count,
+                                               std::vector<vec3_t>(i.width * i.height, BLACK));
+        next_job = 0;
+
+        auto chains = [&](render_stats_t& out, std::vector<vec3_t>& film) {
+            thread_stats = render_stats_t();
+            {
+                scoped_timer_t timer(thread_stats.busy_time);
+                for (uint32_t c = next_job++; c < MLT_CHAINS; c = next_job++) {
+                    uint64_t count = mutations / MLT_CHAINS + (c < mutations % MLT_CHAINS);
+                    run_chain(i, bounds, starts, c, count, film.data());
+                }
+            }
+            stats_merge(out, thread_stats);
+        };
+
+        for (uint32_t t = 0; t < thread_count; t++)
+            threads.emplace_back(chains, std::ref(stats[t]), std::ref(films[t]));
+        for (std::thread& t : threads)
+            t.join();
+
+        float scale = b / mutations;
+        for (const std::vector<vec3_t>& f : films) {
+            for (uint32_t p = 0; p < f.size(); p++)
+                i.film[p] += f[p] * scale;
+        }
+    }
+}
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "defines.hh"
+#include "helpers.hh"
+#include "renderer.hh"
+
+// Path guiding with an SD-tree (Müller et al. 2017). A binary tree splits
+// space; each of its leaves holds a quadtree over the directions, learning
+// where the incident radiance comes from. The path tracer then samples its
+// bounces from a mix of that distribution and the BSDF.
+//
+// Training renders the frame several times before the actual render, with
+// 1, 2, 4... samples per pixel. Each pass samples from what the previous
+// one recorded: the spatial leaves holding many records are split, and the
+// quadrants holding much radiance are refined. Records are inserted in
+// pixel order after each batch of rows, so the trees only depend on the
+// seed.
+
+#if defined(PT_GUIDING)
+namespace RE
+{
+    const uint32_t PG_BATCH_ROWS = 32;
+
+    // Each spatial leaf keeps one quadtree per main axis of the surface
+    // normal: surfaces facing apart do not share a distribution, which
+    // would point half of the samples below them.
+    const uint32_t NORMAL_BINS = 6;
+
+    static uint32_t normal_bin(vec3_t n)
+    {
+        vec3_t a(fabsf(n.x), fabsf(n.y), fabsf(n.z));
+        uint32_t axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        return axis * 2 + (n[axis] < 0.f);
+    }
+
+    // Cylindrical mapping: equal areas of the square are equal solid angles
+    static void direction_to_square(vec3_t d, float *u, float *v)
+    {
+        *u = clamp((d.y + 1.f) * 0.5f, 0.f, 1.f);
+        float phi = atan2f(d.z, d.x) * (1.f / (2.f * PI));
+        *v = phi < 0.f ? phi + 1.f : phi;
+    }
+
+    static vec3_t square_to_direction(float u, float v)
+    {
+        float y = 2.f * u - 1.f;
+        float r = sqrtf(std::max(0.f, 1.f - y * y));
+        float phi = 2.f * PI * v;
+        return vec3_t(r * cosf(phi), y, r * sinf(phi));
+    }
+
+    // Quadrant holding (u, v), which are rescaled to the quadrant's square
+    static uint32_t quadrant(float *u, float *v)
+    {
+        uint32_t qu = *u >= 0.5f;
+        uint32_t qv = *v >= 0.5f;
+        *u = *u * 2.f - qu;
+        *v = *v * 2.f - qv;
+        return qu + 2 * qv;
+    }
+
+    static float node_total(const dtree_node_t& n)
+    {
+        return n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+    }
+
+    static void dtree_record(dtree_t& d, vec3_t direction, float radiance)
+    {
+        float u, v;
+        direction_to_square(direction, &u, &v);
+
+        uint32_t node = 0;
+        while (true) {
+            uint32_t q = quadrant(&u, &v);
+            d.nodes[node].sum[q] += radiance;
+            if (!d.nodes[node].children[q])
+                break;
+            node = d.nodes[node].children[q];
+        }
+        d.samples++;
+    }
+
+    float dtree_pdf(const dtree_t& d, vec3_t direction)
+    {
+        float u, v;
+        direction_to_square(direction, &u, &v);
+
+        float pdf = 1.f;
+        uint32_t node = 0;
+        while (true) {
+            const dtree_node_t& n = d.nodes[node];
+            float total = node_total(n);
+            uint32_t q = quadrant(&u, &v);
+            if (total <= 0.f)
+                break;
+
+            pdf *= 4.f * n.sum[q] / total;
+            if (!n.children[q])
+                break;
+            node = n.children[q];
+        }
+
+        return pdf * (1.f / (4.f * PI));
+    }
+
+    vec3_t dtree_sample(const dtree_t& d)
+    {
+        float u = 0.f, v = 0.f;
+        float size = 1.f;
+        uint32_t node = 0;
+
+        while (true) {
+            const dtree_node_t& n = d.nodes[node];
+            float total = node_total(n);
+            if (total <= 0.f)
+                break;
+
+            float r = rand_0_1() * total;
+            uint32_t q = 0;
+            while (q < 3 && r >= n.sum[q])
+                r -= n.sum[q++];
+
+            size *= 0.5f;
+            u += (q & 1) * size;
+            v += (q >> 1) * size;
+            if (!n.children[q])
+                break;
+            node = n.children[q];
+        }
+
+        return square_to_direction(u + rand_0_1() * size, v + rand_0_1() * size);
+    }
+
+    static uint32_t spatial_leaf(const guiding_tree_t& g, vec3_t p)
+    {
+        vec3_t bb_min = g.bb_min;
+        vec3_t bb_max = g.bb_max;
+        uint32_t node = 0;
+
+        while (g.nodes[node].children[0]) {
+            const stree_node_t& n = g.nodes[node];
+            float mid = (bb_min[n.axis] + bb_max[n.axis]) * 0.5f;
+            if (p[n.axis] < mid) {
+                bb_max[n.axis] = mid;
+                node = n.children[0];
+            }
+            else {
+                bb_min[n.axis] = mid;
+                node = n.children[1];
+            }
+        }
+
+        return g.nodes[node].leaf;
+    }
+
+    const dtree_t *guiding_lookup(const guiding_tree_t& g, vec3_t position, vec3_t normal)
+    {
+        if (g.sampling.empty())
+            return nullptr;
+
+        const dtree_t& d = g.sampling[spatial_leaf(g, position) * NORMAL_BINS + normal_bin(normal)];
+        return node_total(d.nodes[0]) > 0.f ? &d : nullptr;
+    }
+
+    // Rebuilds `src` for the next pass: quadrants holding more than
+    // PG_SUBDIVIDE_ENERGY of the radiance get children, the others are
+    // merged. Sums start over, the shape is all that is kept.
+    static void refine_node(const dtree_t& src, uint32_t src_node, bool from_src,
+                            const float sum[4], float total, uint32_t depth,
+                            dtree_t& out, uint32_t out_node)
+    {
+        for (uint32_t q = 0; q < 4; q++) {
+            if (depth >= PG_MAX_DTREE_DEPTH || sum[q] <= total * PG_SUBDIVIDE_ENERGY)
+                continue;
+
+            uint32_t child = out.nodes.size();
+            out.nodes.push_back(dtree_node_t());
+            out.nodes[out_node].children[q] = child;
+
+            // A leaf quadrant is assumed uniform below
+            bool has_src = from_src && src.nodes[src_node].children[q];
+            uint32_t src_child = has_src ? src.nodes[src_node].children[q] : 0;
+            float child_sum[4];
+            for (uint32_t c = 0; c < 4; c++)
+                child_sum[c] = has_src ? src.nodes[src_child].sum[c] : sum[q] * 0.25f;
+
+            refine_node(src, src_child, has_src, child_sum, total, depth + 1, out, child);
+        }
+    }
+
+    static dtree_t refine(const dtree_t& src)
+    {
+        dtree_t out = dtree_t();
+        out.nodes.push_back(dtree_node_t());
+
+        const dtree_node_t& root = src.nodes[0];
+        refine_node(src, 0, true, root.sum, node_total(root), 1, out, 0);
+        return out;
+    }
+
+    // Splits the leaf until each part holds fewer records than `threshold`,
+    // assuming they spread evenly. Both halves start from the same quadtrees.
+    static void split_leaf(guiding_tree_t& g, uint32_t node, float threshold)
+    {
+        uint32_t leaf = g.nodes[node].leaf;
+        uint32_t samples = 0;
+        for (uint32_t b = 0; b < NORMAL_BINS; b++)
+            samples += g.building[leaf * NORMAL_BINS + b].samples;
+        if (samples <= threshold)
+            return;
+
+        uint32_t other = g.building.size() / NORMAL_BINS;
+        for (uint32_t b = 0; b < NORMAL_BINS; b++) {
+            dtree_t sampled = g.sampling[leaf * NORMAL_BINS + b];
+            dtree_t& half = g.building[leaf * NORMAL_BINS + b];
+            half.samples /= 2;
+            g.sampling.push_back(sampled);
+            g.building.push_back(g.building[leaf * NORMAL_BINS + b]);
+        }
+
+        stree_node_t child = stree_node_t();
+        child.axis = (g.nodes[node].axis + 1) % 3;
+
+        uint32_t id = g.nodes.size();
+        child.leaf = leaf;
+        g.nodes.push_back(child);
+        child.leaf = other;
+        g.nodes.push_back(child);
+        g.nodes[node].children[0] = id;
+        g.nodes[node].children[1] = id + 1;
+
+        split_leaf(g, id, threshold);
+        split_leaf(g, id + 1, threshold);
+    }
+
+    static void end_pass(guiding_tree_t& g, uint32_t pass)
+    {
+        float threshold = PG_SPATIAL_THRESHOLD * sqrtf(1u << pass);
+
+        // Leaves only: the loop appends the new nodes
+        uint32_t count = g.nodes.size();
+        for (uint32_t n = 0; n < count; n++) {
+            if (!g.nodes[n].children[0])
+                split_leaf(g, n, threshold);
+        }
+
+        for (uint32_t l = 0; l < g.building.size(); l++) {
+            g.sampling[l] = g.building[l];
+            g.building[l] = refine(g.building[l]);
+        }
+    }
+
+    void guiding_train(struct renderer_info& i, struct area bounds)
+    {
+        scene_t *scene = i.scene;
+        guiding_tree_t& g = scene->guiding;
+        g = guiding_tree_t();
+
+        // Nothing to sample from during the first pass
+        dtree_t empty = dtree_t();
+        empty.nodes.push_back(dtree_node_t());
+        g.nodes.push_back(stree_node_t());
+        g.building.assign(NORMAL_BINS, empty);
+
+        for (uint32_t pass = 0; pass < PG_ITERATIONS; pass++) {
+            uint32_t spp = 1u << pass;
+            uint64_t seed = (i.seed + pass + 1) * 0xbf58476d1ce4e5b9ULL;
+
+            for (uint32_t y0 = 0; y0 < bounds.h; y0 += PG_BATCH_ROWS) {
+                uint32_t rows = std::min(PG_BATCH_ROWS, bounds.h - y0);
+                std::vector<std::vector<guiding_record_t>> created(rows);
+                parallel_rows(rows, i.thread_count, [&](uint32_t r) {
+                    uint32_t y = bounds.y + y0 + r;
+                    seed_random(seed ^ (y * 0x9e3779b97f4a7c15ULL));
+                    for (uint32_t x = bounds.x; x < bounds.x + bounds.w; x++) {
+                        ray_t ray = get_ray_from_camera(i, x, y);
+                        for (uint32_t s = 0; s < spp; s++)
+                            pathtrace_recorded(scene, ray, created[r]);
+                    }
+                });
+
+                // The box only matters once the space gets split
+                if (pass == 0) {
+                    if (y0 == 0) {
+                        g.bb_min = WHITE * std::numeric_limits<float>::infinity();
+                        g.bb_max = -g.bb_min;
+                    }
+                    for (const std::vector<guiding_record_t>& c : created) {
+                        for (const guiding_record_t& rec : c) {
+                            vec3_t p = rec.position;
+                            g.bb_min = vec3_t(std::min(g.bb_min.x, p.x), std::min(g.bb_min.y, p.y),
+                                              std::min(g.bb_min.z, p.z));
+                            g.bb_max = vec3_t(std::max(g.bb_max.x, p.x), std::max(g.bb_max.y, p.y),
+                                              std::max(g.bb_max.z, p.z));
+                        }
+                    }
+                }
+
+                for (const std::vector<guiding_record_t>& c : created) {
+                    for (const guiding_record_t& rec : c)
+                        dtree_record(g.building[spatial_leaf(g, rec.position) * NORMAL_BINS
+                                                + normal_bin(rec.normal)],
+                                     rec.direction, rec.radiance);
+                }
+            }
+
+            if (g.sampling.empty())
+                g.sampling.assign(NORMAL_BINS, empty);
+            end_pass(g, pass);
+        }
+
+        printf("Path guiding: %zu spatial leaves\n", g.building.size() / NORMAL_BINS);
+    }
+}
+#endif
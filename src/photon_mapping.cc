@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "defines.hh"
+#include "helpers.hh"
+#include "mapping.hh"
+#include "renderer.hh"
+#include "stats.hh"
+
+// Progressive photon mapping (Hachisuka et al. 2008). Each pass emits a new
+// photon map and replaces the previous one, so memory does not grow with
+// the pass count. Every pixel keeps a gather radius and the flux found in
+// it; the radius shrinks as photons come in, which makes the estimate
+// converge instead of staying blurred.
+//
+// Photons are stored as a left-balanced kd-tree in a flat array (Jensen):
+// the children of node i are 2i + 1 and 2i + 2, no pointers involved.
+
+namespace RE
+{
+    const uint32_t PHOTONS_PER_JOB = 1024;
+
+    static float axis_value(vec3_t v, uint8_t axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    static void photon_trace(scene_t *scene, std::vector<photon_t>& out)
+    {
+        area_light_t *l = pick_light(scene);
+        float pdf_pos = pick_light_pdf(scene, l) / area_light_area(l);
+
+        vec3_t n = area_light_normal(l);
+        ray_t r;
+        r.direction = get_cosine_hemisphere_random(n);
+        r.origin = sample_area_light(l) + n * F_EPSYLON;
+
+        // Le * cos / (pdf_pos * pdf_dir), with pdf_dir = cos / PI
+        vec3_t power = l->mlt.emission * l->power * (PI / pdf_pos);
+        vec3_t mask = WHITE;
+
+        for (uint32_t i = 0; i < PM_MAX_DEPTH; i++) {
+            hit_t hit;
+            if (!intersect_scene(scene, r, &hit, RAY_BOUNCE))
+                break;
+            if (hit.object->type == object_type_e::AREA_LIGHT)
+                break;
+
+            vec3_t nl = dot(hit.normal, r.direction) < 0.f ? hit.normal : -hit.normal;
+
+            photon_t p = photon_t();
+            p.position = hit.position;
+            p.power = power * mask;
+            p.normal = nl;
+            out.push_back(p);
+
+            r.direction = get_cosine_hemisphere_random(nl);
+            r.origin = hit.position + nl * F_EPSYLON;
+
+            // (albedo / PI) * cos / pdf, with pdf = cos / PI
+            mask *= get_diffuse_color(scene, hit);
+
+            if (i + 1 >= PM_RR_MIN_DEPTH && !russian_roulette(mask))
+                break;
+        }
+    }
+
+    // Number of nodes left of the root in a complete binary tree of n nodes
+    static uint32_t left_subtree_size(uint32_t n)
+    {
+        if (n <= 1)
+            return 0;
+
+        uint32_t depth = 0;
+        while ((2u << depth) <= n)
+            depth++;
+
+        uint32_t full = (1u << depth) - 1;
+        uint32_t last = n - full;
+        uint32_t half = 1u << (depth - 1);
+        return (full - 1) / 2 + std::min(last, half);
+    }
+
+    static void kd_build(std::vector<photon_t>& src, uint32_t begin, uint32_t end,
+                         std::vector<photon_t>& tree, uint32_t node)
+    {
+        if (begin >= end)
+            return;
+
+        vec3_t bb_min = src[begin].position;
+        vec3_t bb_max = bb_min;
+        for (uint32_t i = begin + 1; i < end; i++) {
+            vec3_t p = src[i].position;
+            bb_min = vec3_t(std::min(bb_min.x, p.x), std::min(bb_min.y, p.y), std::min(bb_min.z, p.z));
+            bb_max = vec3_t(std::max(bb_max.x, p.x), std::max(bb_max.y, p.y), std::max(bb_max.z, p.z));
+        }
+
+        vec3_t extent = bb_max - bb_min;
+        uint8_t axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        uint32_t mid = begin + left_subtree_size(end - begin);
+        std::nth_element(src.begin() + begin, src.begin() + mid, src.begin() + end,
+                         [axis](const photon_t& a, const photon_t& b) {
+                             return axis_value(a.position, axis) < axis_value(b.position, axis);
+                         });
+
+        tree[node] = src[mid];
+        tree[node].axis = axis;
+        kd_build(src, begin, mid, tree, 2 * node + 1);
+        kd_build(src, mid + 1, end, tree, 2 * node + 2);
+    }
+
+    void photon_map_generate(scene_t *scene, uint32_t photons, uint32_t thread_count,
+                             uint64_t seed)
+    {
+        photon_map_t& map = scene->photon_map;
+        if (scene->lights.size() == 0) {
+            map.photons.clear();
+            return;
+        }
+
+        // Same scheme as the MDT lights: seeded jobs, merged in job order
+        uint32_t job_count = (photons + PHOTONS_PER_JOB - 1) / PHOTONS_PER_JOB;
+        std::vector<std::vector<photon_t>> created(job_count);
+        std::atomic<uint32_t> next_job(0);
+        std::vector<std::thread> threads;
+
+        auto work = [&]() {
+            for (uint32_t j = next_job++; j < job_count; j = next_job++) {
+                uint32_t count = std::min(PHOTONS_PER_JOB, photons - j * PHOTONS_PER_JOB);
+                seed_random(seed ^ (j * 0x9e3779b97f4a7c15ULL));
+                for (uint32_t k = 0; k < count; k++)
+                    photon_trace(scene, created[j]);
+            }
+        };
+
+        for (uint32_t i = 0; i < std::max(1u, thread_count); i++)
+            threads.emplace_back(work);
+        for (std::thread& t : threads)
+            t.join();
+
+        std::vector<photon_t> all;
+        for (const std::vector<photon_t>& c : created)
+            all.insert(all.end(), c.begin(), c.end());
+
+        map.photons.resize(all.size());
+        kd_build(all, 0, all.size(), map.photons, 0);
+        map.emitted += photons;
+    }
+
+    // Calls visit(photon, squared distance, r2) for each photon within
+    // sqrt(r2) of p. visit may shrink r2 to prune the rest of the search.
+    template<typename F>
+    static void kd_lookup(const std::vector<photon_t>& tree, uint32_t node, vec3_t p,
+                          float& r2, F visit)
+    {
+        if (node >= tree.size())
+            return;
+
+        const photon_t& ph = tree[node];
+        float d = axis_value(p, ph.axis) - axis_value(ph.position, ph.axis);
+        uint32_t near = d < 0.f ? 2 * node + 1 : 2 * node + 2;
+        uint32_t far = d < 0.f ? 2 * node + 2 : 2 * node + 1;
+
+        kd_lookup(tree, near, p, r2, visit);
+        if (d * d < r2)
+            kd_lookup(tree, far, p, r2, visit);
+
+        vec3_t v = ph.position - p;
+        float dist2 = dot(v, v);
+        if (dist2 < r2)
+            visit(ph, dist2, r2);
+    }
+
+    // Squared distance to the PM_NEAREST-th photon facing nl
+    static float nearest_radius2(const photon_map_t& map, vec3_t p, vec3_t nl)
+    {
+        std::vector<float> heap;
+        float r2 = PM_MAX_RADIUS * PM_MAX_RADIUS;
+
+        heap.reserve(PM_NEAREST);
+        kd_lookup(map.photons, 0, p, r2, [&](const photon_t& ph, float dist2, float& max2) {
+            if (dot(ph.normal, nl) <= 0.f)
+                return;
+
+            heap.push_back(dist2);
+            std::push_heap(heap.begin(), heap.end());
+            if (heap.size() > (size_t)PM_NEAREST) {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.pop_back();
+            }
+            if (heap.size() == (size_t)PM_NEAREST)
+                max2 = heap.front();
+        });
+
+        return r2;
+    }
+
+    vec3_t photon_gather(struct renderer_info& i, uint32_t x, uint32_t y, ray_t ray)
+    {
+        scene_t *scene = i.scene;
+        const photon_map_t& map = scene->photon_map;
+        photon_pixel_t& px = i.photon_pixels[x + y * i.width];
+        hit_t hit;
+
+        if (!intersect_scene(scene, ray, &hit, RAY_PRIMARY))
+            return BLACK;
+
+        if (hit.object->type == object_type_e::AREA_LIGHT) {
+            light_t *l = static_cast<light_t*>(hit.object);
+            return l->mlt.emission * l->power;
+        }
+
+        vec3_t nl = dot(hit.normal, ray.direction) < 0.f ? hit.normal : -hit.normal;
+
+        if (px.radius2 == 0.f)
+            px.radius2 = nearest_radius2(map, hit.position, nl);
+
+        float r2 = px.radius2;
+        float found = 0.f;
+        vec3_t flux = BLACK;
+        kd_lookup(map.photons, 0, hit.position, r2, [&](const photon_t& ph, float, float&) {
+            if (dot(ph.normal, nl) <= 0.f)
+                return;
+            flux += ph.power;
+            found += 1.f;
+        });
+
+        // Keep PM_ALPHA of the new photons and shrink the radius to match
+        if (found > 0.f) {
+            float count = px.count + PM_ALPHA * found;
+            float ratio = count / (px.count + found);
+
+            px.flux = (px.flux + flux * get_diffuse_color(scene, hit) * (1.f / PI)) * ratio;
+            px.radius2 *= ratio;
+            px.count = count;
+        }
+
+        if (map.emitted == 0)
+            return BLACK;
+        return px.flux * (1.f / (PI * px.radius2 * map.emitted));
+    }
+}
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cassert>
+#include <utility>
 #include <math.h>
 #include <stdint.h>
 
@@ -37,6 +40,159 @@ namespace RE
         return 1;
     }
 
+    void spheres_push(geometry_spheres_t& s, vec3_t center, float radius, uint32_t object)
+    {
+        s.cx.push_back(center.x);
+        s.cy.push_back(center.y);
+        s.cz.push_back(center.z);
+        s.radius2.push_back(radius * radius);
+        s.object.push_back(object);
+    }
+
+    void spheres_pad(geometry_spheres_t& s)
+    {
+        while (s.radius2.size() % SIMD_WIDTH) {
+            s.cx.push_back(0.f);
+            s.cy.push_back(0.f);
+            s.cz.push_back(0.f);
+            s.radius2.push_back(-1.f);
+        }
+    }
+
+    // Whether the ray hits sphere k, at *d
+    static inline bool sphere_hit(const geometry_spheres_t& s, uint32_t k, const ray_t& r,
+                                  float *d)
+    {
+        float ex = s.cx[k] - r.origin.x;
+        float ey = s.cy[k] - r.origin.y;
+        float ez = s.cz[k] - r.origin.z;
+
+        float v = ex * r.direction.x + ey * r.direction.y + ez * r.direction.z;
+        float disc = s.radius2[k] - (ex * ex + ey * ey + ez * ez - v * v);
+        float q = sqrtf(std::max(disc, 0.f));
+
+        // From the inside, the far side
+        *d = v - q >= 0.f ? v - q : v + q;
+        return disc >= 0.f && *d >= 0.f;
+    }
+
+    uint32_t intersect_spheres(const geometry_spheres_t& s, const ray_t& r, float *t)
+    {
+        uint32_t found = NO_PRIMITIVE;
+        float best = *t;
+
+        for (uint32_t k = 0; k < s.object.size(); k++) {
+            float d;
+            bool closer = sphere_hit(s, k, r, &d) && d < best;
+            best = closer ? d : best;
+            found = closer ? k : found;
+        }
+
+        *t = best;
+        return found;
+    }
+
+    bool intersect_sphere_at(const geometry_spheres_t& s, uint32_t k, const ray_t& r, float *t)
+    {
+        float d;
+        if (!sphere_hit(s, k, r, &d) || d >= *t)
+            return false;
+        *t = d;
+        return true;
+    }
+
+    static const float lane_index[16] = {
+        0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f, 10.f, 11.f, 12.f, 13.f, 14.f, 15.f
+    };
+
+    // Same test as intersect_spheres. Each lane keeps the closest sphere
+    // it saw, its index as a float (exact up to 2^24); the lanes are
+    // reduced once at the end.
+    uint32_t intersect_spheres_simd(const geometry_spheres_t& s, const ray_t& r, float *t)
+    {
+        assert(s.radius2.size() % SIMD_WIDTH == 0 && "Sphere arrays are not padded");
+        assert(s.radius2.size() < (1u << 24));
+
+        vfloat_t ox = v_set1(r.origin.x), oy = v_set1(r.origin.y), oz = v_set1(r.origin.z);
+        vfloat_t dx = v_set1(r.direction.x), dy = v_set1(r.direction.y), dz = v_set1(r.direction.z);
+        vfloat_t zero = v_set1(0.f);
+        vfloat_t best = v_set1(*t);
+        vfloat_t index = v_set1(-1.f);
+        vfloat_t lane = v_load(lane_index);
+        vfloat_t step = v_set1(SIMD_WIDTH);
+
+        for (uint32_t k = 0; k < s.radius2.size(); k += SIMD_WIDTH) {
+            vfloat_t ex = v_sub(v_load(&s.cx[k]), ox);
+            vfloat_t ey = v_sub(v_load(&s.cy[k]), oy);
+            vfloat_t ez = v_sub(v_load(&s.cz[k]), oz);
+
+            vfloat_t v = v_madd(ex, dx, v_madd(ey, dy, v_mul(ez, dz)));
+            vfloat_t e2 = v_madd(ex, ex, v_madd(ey, ey, v_mul(ez, ez)));
+            vfloat_t disc = v_sub(v_load(&s.radius2[k]), v_sub(e2, v_mul(v, v)));
+            vfloat_t q = v_sqrt(v_max(disc, zero));
+
+            vfloat_t near = v_sub(v, q);
+            vfloat_t d = v_select(v_ge(near, zero), near, v_add(v, q));
+            vmask_t closer = v_and(v_and(v_ge(disc, zero), v_ge(d, zero)), v_lt(d, best));
+            best = v_select(closer, d, best);
+            index = v_select(closer, lane, index);
+            lane = v_add(lane, step);
+        }
+
+        float lanes_t[SIMD_WIDTH], lanes_index[SIMD_WIDTH];
+        v_store(lanes_t, best);
+        v_store(lanes_index, index);
+
+        uint32_t found = NO_PRIMITIVE;
+        for (uint32_t l = 0; l < SIMD_WIDTH; l++) {
+            if (lanes_index[l] >= 0.f && lanes_t[l] < *t) {
+                *t = lanes_t[l];
+                found = lanes_index[l];
+            }
+        }
+        return found;
+    }
+
+    void intersect_spheres_packet(const geometry_spheres_t& s, const ray_packet_t& p,
+                                  float *t, uint32_t *index)
+    {
+        vfloat_t ox = v_load(p.ox), oy = v_load(p.oy), oz = v_load(p.oz);
+        vfloat_t dx = v_load(p.dx), dy = v_load(p.dy), dz = v_load(p.dz);
+        vfloat_t zero = v_set1(0.f);
+        vfloat_t best = v_load(t);
+        vfloat_t found = v_set1(-1.f);
+
+        for (uint32_t k = 0; k < s.object.size(); k++) {
+            vfloat_t ex = v_sub(v_set1(s.cx[k]), ox);
+            vfloat_t ey = v_sub(v_set1(s.cy[k]), oy);
+            vfloat_t ez = v_sub(v_set1(s.cz[k]), oz);
+
+            vfloat_t v = v_madd(ex, dx, v_madd(ey, dy, v_mul(ez, dz)));
+            vfloat_t e2 = v_madd(ex, ex, v_madd(ey, ey, v_mul(ez, ez)));
+            vfloat_t disc = v_sub(v_set1(s.radius2[k]), v_sub(e2, v_mul(v, v)));
+
+            // Most spheres miss every ray of the packet
+            vmask_t touch = v_ge(disc, zero);
+            if (!v_bits(touch))
+                continue;
+
+            vfloat_t q = v_sqrt(v_max(disc, zero));
+            vfloat_t near = v_sub(v, q);
+            vfloat_t d = v_select(v_ge(near, zero), near, v_add(v, q));
+            vmask_t closer = v_and(v_and(touch, v_ge(d, zero)), v_lt(d, best));
+            best = v_select(closer, d, best);
+            found = v_select(closer, v_set1(k), found);
+        }
+
+        float lanes_index[SIMD_WIDTH];
+        v_store(t, best);
+        v_store(lanes_index, found);
+        for (uint32_t l = 0; l < SIMD_WIDTH; l++) {
+            if (lanes_index[l] >= 0.f)
+                index[l] = lanes_index[l];
+        }
+    }
+
     uint8_t intersect_plane(ray_t r, vec3_t a, vec3_t normal, hit_t *hit)
     {
         r.direction = normalize(r.direction);
@@ -55,33 +211,259 @@ namespace RE
         return true;
     }
 
-    uint8_t intersect_tri(ray_t r, vec3_t a, vec3_t b, vec3_t c, hit_t *out)
+    ray_shear_t get_ray_shear(const ray_t& r)
     {
-        hit_t hit;
+        float d[3] = { r.direction.x, r.direction.y, r.direction.z };
+        ray_shear_t s;
 
-        vec3_t ab = normalize(b - a);
-        vec3_t ac = normalize(c - a);
-        vec3_t normal = normalize(cross(ab, ac));
+        s.kz = fabsf(d[0]) > fabsf(d[1]) ? (fabsf(d[0]) > fabsf(d[2]) ? 0 : 2)
+                                         : (fabsf(d[1]) > fabsf(d[2]) ? 1 : 2);
+        s.kx = (s.kz + 1) % 3;
+        s.ky = (s.kx + 1) % 3;
+        // Keeps the winding, so the sign of the edge functions tells the side
+        if (d[s.kz] < 0.f)
+            std::swap(s.kx, s.ky);
 
-        if (dot(normal, r.direction) > 0) // Back culling
-            return 0;
+        s.sx = d[s.kx] / d[s.kz];
+        s.sy = d[s.ky] / d[s.kz];
+        s.sz = 1.f / d[s.kz];
 
-        if (!intersect_plane(r, a, normal, &hit))
-            return 0;
+        float o[3] = { r.origin.x, r.origin.y, r.origin.z };
+        s.ox = o[s.kx];
+        s.oy = o[s.ky];
+        s.oz = o[s.kz];
+        return s;
+    }
 
-        vec3_t tmp = cross(b - a, hit.position - a);
-        if (dot(hit.normal, tmp) < 0)
-            return 0;
+    // An edge function that rounds to 0 in single precision, where the ray
+    // may pass on either side, recomputed in double (Woop et al. 2013): the
+    // products are exact, only their difference rounds.
+    static inline float edge_double(float px, float py, float qx, float qy)
+    {
+        return (double)px * qy - (double)py * qx;
+    }
 
-        tmp = cross(c - b, hit.position - b);
-        if (dot(hit.normal, tmp) < 0)
-            return 0;
+    // Edge functions of the triangle, given its corners relative to the
+    // ray origin and permuted as (kx, ky, kz): the doubled signed areas the
+    // ray makes with each edge in the sheared space, which are the
+    // barycentrics of the opposite corners once divided by their sum. An
+    // edge shared by two triangles gets the same value (negated) in both,
+    // so no ray passes between them, as long as the products are rounded
+    // before the difference: this file is built with -ffp-contract=off.
+    // All positive on a front face.
+    static inline void sheared_triangle(const ray_shear_t& s,
+                                        float ax, float ay, float az,
+                                        float bx, float by, float bz,
+                                        float cx, float cy, float cz,
+                                        float *u, float *v, float *w, float *t)
+    {
+        ax -= s.sx * az;
+        ay -= s.sy * az;
+        bx -= s.sx * bz;
+        by -= s.sy * bz;
+        cx -= s.sx * cz;
+        cy -= s.sy * cz;
+
+        *u = cx * by - cy * bx;
+        *v = ax * cy - ay * cx;
+        *w = bx * ay - by * ax;
+        *u = *u == 0.f ? edge_double(cx, cy, bx, by) : *u;
+        *v = *v == 0.f ? edge_double(ax, ay, cx, cy) : *v;
+        *w = *w == 0.f ? edge_double(bx, by, ax, ay) : *w;
+        *t = (*u * az + *v * bz + *w * cz) * s.sz / (*u + *v + *w);
+    }
+
+    // Bitwise operators: no branch, so the loops stay vectorizable
+    static inline bool sheared_hit(float u, float v, float w, bool double_sided)
+    {
+        bool front = (u >= 0.f) & (v >= 0.f) & (w >= 0.f);
+        bool back = (u <= 0.f) & (v <= 0.f) & (w <= 0.f);
+        return (front | (double_sided & back)) & (u + v + w != 0.f);
+    }
+
+    void triangles_push(geometry_triangles_t& g, vec3_t a, vec3_t b, vec3_t c,
+                        uint32_t object, uint32_t vertex)
+    {
+        uint32_t lane = g.object.size() % SIMD_WIDTH;
+        if (lane == 0)
+            g.blocks.push_back(tri_block_t());
+
+        const vec3_t corners[3] = { a, b, c };
+        tri_block_t& block = g.blocks.back();
+        for (uint32_t i = 0; i < 3; i++) {
+            block.v[i][0][lane] = corners[i].x;
+            block.v[i][1][lane] = corners[i].y;
+            block.v[i][2][lane] = corners[i].z;
+        }
+        block.count++;
+        g.object.push_back(object);
+        g.vertex.push_back(vertex);
+    }
+
+    void triangles_pad(geometry_triangles_t& g)
+    {
+        while (g.object.size() % SIMD_WIDTH) {
+            g.object.push_back(NO_PRIMITIVE);
+            g.vertex.push_back(0);
+        }
+    }
+
+    void triangles_get(const geometry_triangles_t& g, uint32_t k, vec3_t *a, vec3_t *b, vec3_t *c)
+    {
+        const tri_block_t& block = g.blocks[k / SIMD_WIDTH];
+        uint32_t lane = k % SIMD_WIDTH;
+        vec3_t *corners[3] = { a, b, c };
+        for (uint32_t i = 0; i < 3; i++)
+            *corners[i] = vec3_t(block.v[i][0][lane], block.v[i][1][lane], block.v[i][2][lane]);
+    }
+
+    uint32_t intersect_triangles(const geometry_triangles_t& g, const ray_t& r,
+                                 bool double_sided, float *t, vec3_t *barycentric)
+    {
+        ray_shear_t s = get_ray_shear(r);
+
+        uint32_t found = NO_PRIMITIVE;
+        float best = *t;
+        float best_u = 0.f, best_v = 0.f, best_det = 1.f;
+
+        for (uint32_t k = 0; k < g.object.size(); k++) {
+            const tri_block_t& b = g.blocks[k / SIMD_WIDTH];
+            uint32_t l = k % SIMD_WIDTH;
+
+            float u, v, w, d;
+            sheared_triangle(s, b.v[0][s.kx][l] - s.ox, b.v[0][s.ky][l] - s.oy, b.v[0][s.kz][l] - s.oz,
+                                b.v[1][s.kx][l] - s.ox, b.v[1][s.ky][l] - s.oy, b.v[1][s.kz][l] - s.oz,
+                                b.v[2][s.kx][l] - s.ox, b.v[2][s.ky][l] - s.oy, b.v[2][s.kz][l] - s.oz,
+                                &u, &v, &w, &d);
+
+            bool closer = (l < b.count) & sheared_hit(u, v, w, double_sided)
+                        & (d >= 0.f) & (d < best);
+            best = closer ? d : best;
+            best_u = closer ? u : best_u;
+            best_v = closer ? v : best_v;
+            best_det = closer ? u + v + w : best_det;
+            found = closer ? k : found;
+        }
+
+        *t = best;
+        if (found != NO_PRIMITIVE) {
+            float u = best_u / best_det, v = best_v / best_det;
+            *barycentric = vec3_t(u, v, 1.f - u - v);
+        }
+        return found;
+    }
+
+    // sheared_triangle and sheared_hit over the lanes of the block. Most
+    // blocks miss: the lanes are only looked at when one of them hits, or
+    // when an edge function needs the double precision one. The unused
+    // lanes are masked.
+    int32_t intersect_tri_block(const tri_block_t& b, const ray_shear_t& s,
+                                bool double_sided, float *t, vec3_t *barycentric)
+    {
+        vfloat_t sx = v_set1(s.sx), sy = v_set1(s.sy), sz = v_set1(s.sz);
+        vfloat_t ox = v_set1(s.ox), oy = v_set1(s.oy), oz = v_set1(s.oz);
+        vfloat_t zero = v_set1(0.f);
+
+        vfloat_t az = v_sub(v_load(b.v[0][s.kz]), oz);
+        vfloat_t bz = v_sub(v_load(b.v[1][s.kz]), oz);
+        vfloat_t cz = v_sub(v_load(b.v[2][s.kz]), oz);
+        vfloat_t ax = v_sub(v_sub(v_load(b.v[0][s.kx]), ox), v_mul(sx, az));
+        vfloat_t ay = v_sub(v_sub(v_load(b.v[0][s.ky]), oy), v_mul(sy, az));
+        vfloat_t bx = v_sub(v_sub(v_load(b.v[1][s.kx]), ox), v_mul(sx, bz));
+        vfloat_t by = v_sub(v_sub(v_load(b.v[1][s.ky]), oy), v_mul(sy, bz));
+        vfloat_t cx = v_sub(v_sub(v_load(b.v[2][s.kx]), ox), v_mul(sx, cz));
+        vfloat_t cy = v_sub(v_sub(v_load(b.v[2][s.ky]), oy), v_mul(sy, cz));
+
+        vfloat_t u = v_sub(v_mul(cx, by), v_mul(cy, bx));
+        vfloat_t v = v_sub(v_mul(ax, cy), v_mul(ay, cx));
+        vfloat_t w = v_sub(v_mul(bx, ay), v_mul(by, ax));
+
+        uint32_t lanes = (1u << b.count) - 1;
+        uint32_t edges = ~v_bits(v_and(v_and(v_ne(u, zero), v_ne(v, zero)), v_ne(w, zero)))
+                       & lanes;
+        if (edges) {
+            float p[6][SIMD_WIDTH], e[3][SIMD_WIDTH];
+            const vfloat_t corners[6] = { ax, ay, bx, by, cx, cy };
+            for (uint32_t k = 0; k < 6; k++)
+                v_store(p[k], corners[k]);
+            v_store(e[0], u);
+            v_store(e[1], v);
+            v_store(e[2], w);
+
+            for (; edges; edges &= edges - 1) {
+                uint32_t l = __builtin_ctz(edges);
+                if (e[0][l] == 0.f)
+                    e[0][l] = edge_double(p[4][l], p[5][l], p[2][l], p[3][l]);
+                if (e[1][l] == 0.f)
+                    e[1][l] = edge_double(p[0][l], p[1][l], p[4][l], p[5][l]);
+                if (e[2][l] == 0.f)
+                    e[2][l] = edge_double(p[2][l], p[3][l], p[0][l], p[1][l]);
+            }
+            u = v_load(e[0]);
+            v = v_load(e[1]);
+            w = v_load(e[2]);
+        }
+
+        vfloat_t det = v_add(v_add(u, v), w);
+        vfloat_t d = v_div(v_mul(v_madd(u, az, v_madd(v, bz, v_mul(w, cz))), sz), det);
+
+        vmask_t side = v_and(v_and(v_ge(u, zero), v_ge(v, zero)), v_ge(w, zero));
+        if (double_sided)
+            side = v_or(side, v_and(v_and(v_le(u, zero), v_le(v, zero)), v_le(w, zero)));
+        vmask_t closer = v_and(v_and(side, v_ne(det, zero)),
+                               v_and(v_ge(d, zero), v_lt(d, v_set1(*t))));
+
+        uint32_t bits = v_bits(closer) & lanes;
+        if (!bits)
+            return -1;
+
+        float lanes_t[SIMD_WIDTH], lanes_u[SIMD_WIDTH], lanes_v[SIMD_WIDTH], lanes_det[SIMD_WIDTH];
+        v_store(lanes_t, d);
+        v_store(lanes_u, u);
+        v_store(lanes_v, v);
+        v_store(lanes_det, det);
+
+        int32_t found = -1;
+        for (uint32_t l = 0; l < SIMD_WIDTH; l++) {
+            if ((bits >> l) & 1 && lanes_t[l] < *t) {
+                *t = lanes_t[l];
+                found = l;
+            }
+        }
+
+        float bu = lanes_u[found] / lanes_det[found], bv = lanes_v[found] / lanes_det[found];
+        *barycentric = vec3_t(bu, bv, 1.f - bu - bv);
+        return found;
+    }
+
+    uint32_t intersect_triangles_simd(const geometry_triangles_t& g, const ray_t& r,
+                                      bool double_sided, float *t, vec3_t *barycentric)
+    {
+        ray_shear_t s = get_ray_shear(r);
+        uint32_t found = NO_PRIMITIVE;
+
+        for (uint32_t k = 0; k < g.blocks.size(); k++) {
+            int32_t lane = intersect_tri_block(g.blocks[k], s, double_sided, t, barycentric);
+            found = lane >= 0 ? k * SIMD_WIDTH + lane : found;
+        }
+        return found;
+    }
+
+    uint8_t intersect_tri(ray_t r, vec3_t a, vec3_t b, vec3_t c, hit_t *out)
+    {
+        ray_shear_t s = get_ray_shear(r);
+        float pa[3] = { a.x - r.origin.x, a.y - r.origin.y, a.z - r.origin.z };
+        float pb[3] = { b.x - r.origin.x, b.y - r.origin.y, b.z - r.origin.z };
+        float pc[3] = { c.x - r.origin.x, c.y - r.origin.y, c.z - r.origin.z };
 
-        tmp = cross(a - c, hit.position - c);
-        if (dot(hit.normal, tmp) < 0)
+        float u, v, w, t;
+        sheared_triangle(s, pa[s.kx], pa[s.ky], pa[s.kz], pb[s.kx], pb[s.ky], pb[s.kz],
+                         pc[s.kx], pc[s.ky], pc[s.kz], &u, &v, &w, &t);
+        if (!sheared_hit(u, v, w, false) || t < 0.f)
             return 0;
 
-        *out = hit;
+        out->position = r.origin + r.direction * t;
+        out->normal = normalize(cross(b - a, c - a));
         return 1;
     }
 }
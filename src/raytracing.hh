@@ -1,5 +1,6 @@
 #pragma once
 
+#include "simd.hh"
 #include "types.hh"
 #include "vectors.hh"
 
@@ -18,7 +19,63 @@ namespace RE
         RE::object_t *object;
     } hit_t;
 
+    // SIMD_WIDTH rays, one per lane
+    typedef struct ray_packet {
+        float ox[SIMD_WIDTH], oy[SIMD_WIDTH], oz[SIMD_WIDTH];
+        float dx[SIMD_WIDTH], dy[SIMD_WIDTH], dz[SIMD_WIDTH];
+    } ray_packet_t;
+
+    const uint32_t NO_PRIMITIVE = UINT32_MAX;
+
     uint8_t intersect_sphere(ray_t r, vec3_t center, float rad, hit_t *out);
+
+    void spheres_push(geometry_spheres_t& s, vec3_t center, float radius, uint32_t object);
+    // Pads the arrays to a whole number of SIMD blocks, with spheres no
+    // ray can hit
+    void spheres_pad(geometry_spheres_t& s);
+
+    // Closest sphere under *t along the normalized ray, lowering *t to its
+    // distance, or NO_PRIMITIVE. One sphere at a time, or SIMD_WIDTH at once
+    // (the arrays padded).
+    uint32_t intersect_spheres(const geometry_spheres_t& s, const ray_t& r, float *t);
+    uint32_t intersect_spheres_simd(const geometry_spheres_t& s, const ray_t& r, float *t);
+    // Sphere k alone: whether it lowered *t
+    bool intersect_sphere_at(const geometry_spheres_t& s, uint32_t k, const ray_t& r, float *t);
+    // The same for each ray of the packet, t and index holding SIMD_WIDTH:
+    // the index of a ray that found nothing closer is left alone
+    void intersect_spheres_packet(const geometry_spheres_t& s, const ray_packet_t& p,
+                                  float *t, uint32_t *index);
     uint8_t intersect_plane(ray_t r, vec3_t a, vec3_t normal, hit_t *hit);
+
+    // Per ray part of the watertight triangle test (Woop, Benthin and Wald,
+    // 2013): the ray becomes the z axis of a sheared space, where the
+    // triangles are tested in 2D.
+    typedef struct ray_shear {
+        uint32_t kx, ky, kz; // Axes of the ray space, z the largest direction one
+        float sx, sy, sz;
+        float ox, oy, oz; // The origin, along kx, ky, kz
+    } ray_shear_t;
+
+    ray_shear_t get_ray_shear(const ray_t& r);
+
+    void triangles_push(geometry_triangles_t& g, vec3_t a, vec3_t b, vec3_t c,
+                        uint32_t object, uint32_t vertex);
+    // Leaves the rest of the last block unused
+    void triangles_pad(geometry_triangles_t& g);
+    void triangles_get(const geometry_triangles_t& g, uint32_t k, vec3_t *a, vec3_t *b, vec3_t *c);
+
+    // Closest triangle under *t, lowering *t to its distance and setting the
+    // weights of its corners a, b, c in *barycentric, or NO_PRIMITIVE. Back
+    // faces are culled unless double_sided. One triangle at a time, or a
+    // block at once.
+    uint32_t intersect_triangles(const geometry_triangles_t& g, const ray_t& r,
+                                 bool double_sided, float *t, vec3_t *barycentric);
+    uint32_t intersect_triangles_simd(const geometry_triangles_t& g, const ray_t& r,
+                                      bool double_sided, float *t, vec3_t *barycentric);
+    // The same over the SIMD_WIDTH triangles of one block: the lane of the
+    // closest, or -1
+    int32_t intersect_tri_block(const tri_block_t& b, const ray_shear_t& s,
+                                bool double_sided, float *t, vec3_t *barycentric);
+    // Front faces only, same test
     uint8_t intersect_tri(ray_t r, vec3_t a, vec3_t b, vec3_t c, hit_t *out);
 }
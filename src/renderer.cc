@@ -1,372 +1,525 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <limits>
 #include <string.h>
+#include <thread>
+#include <vector>
 
 #include "defines.hh"
 #include "helpers.hh"
 #include "mapping.hh"
 #include "raytracing.hh"
 #include "renderer.hh"
+#include "stats.hh"
 
 namespace RE
 {
-    ray_t get_ray_from_camera(struct renderer_info& i, uint32_t x, uint32_t y)
+    vec3_t raytrace(scene_t *scene, ray_t ray, uint32_t bounce)
     {
-        scene_t *scene = i.scene;
-        float width = i.width;
-        float height = i.height;
-        const float FOV = 45.0;
+        vec3_t luminance(0.1, 0.1, 0.1);
+        hit_t hit;
 
-        float L = width / (tan(DEG2RAD * FOV * 0.5) * 2.0);
+        if (!intersect_scene(scene, ray, &hit, bounce ? RAY_BOUNCE : RAY_PRIMARY))
+            return luminance;
 
-        vec3_t middle = scene->camera_position + scene->camera_direction * L;
-        float s_width = lerp(-width, width, x / width) / 2.0;
-        float s_height = lerp(-height, height, y / height) / 2.0;
+        if (hit.object->type == object_type_e::AREA_LIGHT)
+            return hit.object->mlt.emission;
 
-        vec3_t screen_ptr = VECTOR_RIGHT * s_width
-                      - VECTOR_UP * s_height
-                      + middle;
+#if defined(RT_ENABLE_SHADOWS)
+        vec3_t light = vec3_t(0.0);
 
-        vec3_t direction = screen_ptr - scene->camera_position;
-        vec3_t origin = scene->camera_position;
+        for (object_t *o : scene->objects) {
+            if (o->type != object_type_e::AREA_LIGHT)
+                continue;
 
-        return { origin, normalize(direction) };
-    }
+             vec3_t l = vec3_t(0.0);
+             for (uint32_t i = 0; i < RT_SOFT_SHADOW_SAMPLES; i++) {
+                 ray_t r;
+                 r.origin = hit.position + hit.normal * F_EPSYLON;
+                 vec3_t d1 = normalize(o->position - hit.position);
+                 vec3_t d2 = get_hemisphere_random(hit.normal);
 
-    static bool intersect_sphere(object_sphere_t *o, ray_t r, hit_t *out)
-    {
-        bool touch = intersect_sphere(r, o->position, o->radius, out);
-        if (touch)
-            out->uv_coord = get_sphere_uv(o->position, out->position);
-        return touch;
+                 r.direction = lerp(d1, d2, RT_SOFT_SHADOW_RADIUS);
+                 hit_t h;
+
+                 if (!intersect_scene(scene, r, &h, RAY_SHADOW))
+                     continue;
+                 if (h.object->type != object_type_e::AREA_LIGHT)
+                     continue;
 
+                 l = l + h.object->mlt.emission * (1.0f / RT_SOFT_SHADOW_SAMPLES);
+             }
+             light = light + l;
+        }
+        return get_diffuse_color(scene, hit) * light;
+#else
+        return get_diffuse_color(scene, hit);
+#endif
     }
 
-    static bool intersect_plane(object_plane_t *o, ray_t r, hit_t *out)
+    static float max_component(vec3_t c)
     {
-        return intersect_plane(r, o->position, rotate(o->normal, o->rotation), out);
+        return std::max(c.r, std::max(c.g, c.b));
     }
 
-    static bool intersect_mesh(object_mesh_t *o, ray_t r, hit_t *out)
+    void collect_lights(scene_t *scene)
     {
-        hit_t hit;
-        bool touch = false;
-        float depth = std::numeric_limits<float>::infinity();
-
-        assert(o->vtx_count > 0 && "An empty mesh is in the rendering system");
-        assert(o->vtx_count % 3 == 0 && "Invalid vtx count. Must be multiple of 3");
-
-        for (uint64_t i = 0; i < o->vtx_count; i += 3) {
-            hit_t local_hit;
+        std::vector<float> power;
 
-            vec3_t vtx[3]  = {
-                rotate(o->vtx[i + 0], o->rotation) + o->position,
-                rotate(o->vtx[i + 1], o->rotation) + o->position,
-                rotate(o->vtx[i + 2], o->rotation) + o->position
-            };
+        for (uint32_t k = 0; k < scene->objects.size(); k++)
+            scene->objects[k]->id = k;
 
-            if (!intersect_tri(r, vtx[0], vtx[1], vtx[2], &local_hit))
+        scene->lights.clear();
+        for (object_t *o : scene->objects) {
+            if (o->type != object_type_e::AREA_LIGHT)
                 continue;
 
-            touch = true;
-            float local_depth = magnitude(local_hit.position - r.origin);
-            if (local_depth < depth) {
-                hit = local_hit;
-                hit.uv_coord = get_triangle_uv(vtx, o->uv + i, hit.position);
-                depth = local_depth;
-            }
+            area_light_t *l = static_cast<area_light_t*>(o);
+            l->index = scene->lights.size();
+            scene->lights.push_back(l);
+            power.push_back(max_component(l->mlt.emission) * l->power * area_light_area(l));
         }
-
-        *out = hit;
-        return touch;
+        alias_table_build(scene->light_distribution, power);
     }
 
-    static bool intersect_area_light(area_light_t *o, ray_t r, hit_t *out)
+    area_light_t *pick_light(scene_t *scene)
     {
-        hit_t hit;
+        uint32_t id = alias_table_sample(scene->light_distribution, rand_0_1());
+        return static_cast<area_light_t*>(scene->lights[id]);
+    }
 
-        vec3_t vt = rotate(o->size, o->rotation);
-        vec3_t a = vec3_t(-vt.x * 0.5, 0, -vt.z * 0.5);
-        vec3_t b = vec3_t(-vt.x * 0.5, 0,  vt.z * 0.5);
-        vec3_t c = vec3_t( vt.x * 0.5, 0,  vt.z * 0.5);
-        vec3_t d = vec3_t( vt.x * 0.5, 0, -vt.z * 0.5);
+    float pick_light_pdf(scene_t *scene, light_t *l)
+    {
+        return scene->light_distribution.pdf[l->index];
+    }
 
-        a = a + o->position;
-        b = b + o->position;
-        c = c + o->position;
-        d = d + o->position;
+    vec3_t area_light_extent(const area_light_t *l)
+    {
+        return rotate(l->size, l->rotation);
+    }
 
-        if (intersect_tri(r, a, d, c, out))
-            return true;
+    vec3_t area_light_normal(const area_light_t *l)
+    {
+        // Faces down, unless the rotation flipped one of its sides
+        vec3_t vt = area_light_extent(l);
+        return vec3_t(0.f, vt.x * vt.z >= 0.f ? -1.f : 1.f, 0.f);
+    }
 
-        if (intersect_tri(r, a, c, b, out))
-            return true;
+    float area_light_area(const area_light_t *l)
+    {
+        vec3_t vt = area_light_extent(l);
+        return fabs(vt.x * vt.z);
+    }
 
-        return false;
+    vec3_t sample_area_light(area_light_t *l)
+    {
+        vec3_t vt = area_light_extent(l);
+        return l->position + vec3_t(vt.x * (rand_0_1() - 0.5f), 0, vt.z * (rand_0_1() - 0.5f));
     }
 
-    static bool intersect_scene(scene_t *scene, ray_t ray, hit_t *out)
+    bool russian_roulette(vec3_t& mask)
     {
-        hit_t hit;
-        float depth = std::numeric_limits<float>::infinity();
-        bool touch = false;
+        float q = std::min(0.95f, std::max(mask.r, std::max(mask.g, mask.b)));
+        if (rand_0_1() >= q)
+            return false;
 
-        for (object_t *o : scene->objects) {
-            hit_t local_hit;
-            bool local_touch = false;
-
-            switch (o->type) {
-                case object_type_e::SPHERE:
-                    local_touch = intersect_sphere((object_sphere_t*)o, ray, &local_hit);
-                    break;
-                case object_type_e::PLANE:
-                    local_touch = intersect_plane((object_plane_t*)o, ray, &local_hit);
-                    break;
-                case object_type_e::MESH:
-                    local_touch = intersect_mesh((object_mesh_t*)o, ray, &local_hit);
-                    break;
-                case object_type_e::AREA_LIGHT:
-                    local_touch = intersect_area_light((area_light_t*)o, ray, &local_hit);
-                    break;
-                default:
-                    assert(0 && "Object type unknown.");
-            };
-
-            if (!local_touch)
-                continue;
-            touch = true;
+        mask *= 1.0f / q;
+        return true;
+    }
 
-            float tmp_depth = magnitude(local_hit.position - ray.origin);
+#if defined(PT_IRRADIANCE_CACHE) && !defined(PT_NEE)
+    #error "PT_IRRADIANCE_CACHE samples direct light through PT_NEE"
+#endif
 
-            if (tmp_depth < depth) {
-                hit = local_hit;
-                hit.object = o;
-                depth = tmp_depth;
-            }
+    // Samples the bounce direction at a diffuse point, from the cosine or
+    // from the learned distribution `guide` when there is one. Returns
+    // (1 / PI) * cos / pdf, albedo excluded, and the solid angle pdf.
+    static float sample_bounce(const dtree_t *guide, vec3_t nl, vec3_t *direction, float *pdf)
+    {
+#if defined(PT_GUIDING)
+        if (guide) {
+            if (rand_0_1() < PG_BSDF_FRACTION)
+                *direction = get_cosine_hemisphere_random(nl);
+            else
+                *direction = dtree_sample(*guide);
+
+            float cos_x = dot(*direction, nl);
+            *pdf = PG_BSDF_FRACTION * std::max(0.f, cos_x) / PI
+                 + (1.f - PG_BSDF_FRACTION) * dtree_pdf(*guide, *direction);
+            return cos_x > 0.f && *pdf > 0.f ? cos_x / (PI * *pdf) : 0.f;
         }
-
-        *out = hit;
-        return touch;
+#endif
+        *direction = get_cosine_hemisphere_random(nl);
+        *pdf = dot(*direction, nl) / PI;
+        return 1.f;
     }
 
-    vec3_t raytrace(scene_t *scene, ray_t ray, uint32_t bounce)
+#if defined(PT_NEE)
+    // Solid angle pdf of reaching `p` on `l` from `from` when sampling lights
+    static float area_light_pdf(scene_t *scene, area_light_t *l, vec3_t from, vec3_t p)
     {
-        vec3_t luminance(0.1, 0.1, 0.1);
-        hit_t hit;
-
-        if (!intersect_scene(scene, ray, &hit))
-            return luminance;
-
-        if (hit.object->type == object_type_e::AREA_LIGHT)
-            return hit.object->mlt.emission;
-
-#if defined(RT_ENABLE_SHADOWS)
-        vec3_t light = vec3_t(0.0);
-
-        for (object_t *o : scene->objects) {
-            if (o->type != object_type_e::AREA_LIGHT)
-                continue;
+        float area = area_light_area(l);
+        vec3_t d = p - from;
+        float dist2 = dot(d, d);
+        float cos_l = -dot(area_light_normal(l), normalize(d));
+
+        if (cos_l <= 0.f || area <= 0.f)
+            return 0.f;
+        return dist2 / (cos_l * area) * pick_light_pdf(scene, l);
+    }
 
-             vec3_t l = vec3_t(0.0);
-             for (uint32_t i = 0; i < RT_SOFT_SHADOW_SAMPLES; i++) {
-                 ray_t r;
-                 r.origin = hit.position + hit.normal * F_EPSYLON;
-                 vec3_t d1 = normalize(o->position - hit.position);
-                 vec3_t d2 = get_hemisphere_random(hit.normal);
+    static float power_heuristic(float a, float b)
+    {
+        a *= a;
+        b *= b;
+        return a + b > 0.f ? a / (a + b) : 0.f;
+    }
 
-                 r.direction = lerp(d1, d2, RT_SOFT_SHADOW_RADIUS);
-                 hit_t h;
+    // Next event estimation: radiance reaching a diffuse point from one
+    // sampled light point, MIS-weighted against the bounce sampling unless
+    // the caller does not sample bounces. The albedo is left to the caller.
+    static vec3_t sample_direct_light(scene_t *scene, vec3_t position, vec3_t nl, bool mis,
+                                      const dtree_t *guide)
+    {
+        if (scene->lights.size() == 0)
+            return BLACK;
+
+        area_light_t *l = pick_light(scene);
+        vec3_t p = sample_area_light(l);
+
+        ray_t r;
+        r.origin = position + nl * F_EPSYLON;
+        r.direction = normalize(p - r.origin);
+
+        float cos_x = dot(r.direction, nl);
+        float light_pdf = area_light_pdf(scene, l, r.origin, p);
+        if (cos_x <= 0.f || light_pdf <= 0.f)
+            return BLACK;
+
+        hit_t h;
+        if (!intersect_scene(scene, r, &h, RAY_SHADOW) || h.object != l)
+            return BLACK;
+
+        float bsdf_pdf = cos_x / PI;
+#if defined(PT_GUIDING)
+        if (guide)
+            bsdf_pdf = PG_BSDF_FRACTION * bsdf_pdf
+                     + (1.f - PG_BSDF_FRACTION) * dtree_pdf(*guide, r.direction);
+#endif
+        float w = mis ? power_heuristic(light_pdf, bsdf_pdf) : 1.f;
 
-                 if (!intersect_scene(scene, r, &h))
-                     continue;
-                 if (h.object->type != object_type_e::AREA_LIGHT)
-                     continue;
+        // Le * (1 / PI) * cos / pdf, albedo excluded
+        return l->mlt.emission * l->power * (cos_x / PI * w / light_pdf);
+    }
+#endif
 
-                 l = l + h.object->mlt.emission * (1.0f / RT_SOFT_SHADOW_SAMPLES);
-             }
-             light = light + l;
-        }
-        return get_diffuse_color(scene, hit) * light;
-#else
-        return get_diffuse_color(scene, hit);
+#if defined(PT_GUIDING)
+    // A bounce waiting for the radiance that comes back along it
+    typedef struct guided_vertex {
+        vec3_t position;
+        vec3_t normal;
+        vec3_t direction;
+        vec3_t color; // Path radiance before the bounce
+        vec3_t mask; // Path throughput after it
+        float cos_pdf; // Cosine of the bounce over its density
+    } guided_vertex_t;
 #endif
-    }
 
-    vec3_t pathtrace(scene_t *scene, ray_t ray)
+    // Records the incident radiance of each bounce in `records` when set,
+    // and the light reaching the camera through at most one bounce in
+    // `direct`.
+    static vec3_t trace_path(scene_t *scene, ray_t ray, std::vector<guiding_record_t> *records,
+                             vec3_t *direct)
     {
         vec3_t mask = WHITE;
         vec3_t color = BLACK;
+        if (direct)
+            *direct = BLACK;
+#if defined(PT_NEE)
+        float bsdf_pdf = 0.f;
+#endif
+#if defined(PT_GUIDING)
+        guided_vertex_t bounces[PT_MAX_DEPTH];
+        uint32_t bounce_count = 0;
+#endif
 
         for (uint32_t i = 0; i < PT_MAX_DEPTH; i++) {
             hit_t hit;
 
-            if (!intersect_scene(scene, ray, &hit)) {
-                color = BLACK;
+            // Escaping paths keep what light sampling already gathered
+            if (!intersect_scene(scene, ray, &hit, i ? RAY_BOUNCE : RAY_PRIMARY))
                 break;
-            }
 
             if (hit.object->type == object_type_e::AREA_LIGHT) {
                 area_light_t *l = static_cast<area_light_t*>(hit.object);
-                color += mask * l->mlt.emission * l->power;
+                float w = 1.f;
+#if defined(PT_NEE)
+                // Camera rays have no light sampling counterpart
+                if (i > 0)
+                    w = power_heuristic(bsdf_pdf,
+                                        area_light_pdf(scene, l, ray.origin, hit.position));
+#endif
+                vec3_t emitted = mask * l->mlt.emission * l->power * w;
+                color += emitted;
+                if (direct && i <= 1)
+                    *direct += emitted;
+#if defined(PT_GUIDING)
+                // Light sampling already covers it: only indirect light
+                // is worth guiding to.
+                if (bounce_count)
+                    bounces[bounce_count - 1].color = color;
+#endif
                 break;
             }
 
             vec3_t nl = hit.normal;
             nl *= dot(hit.normal, ray.direction) < 0 ? 1.0f : -1.0f;
+            vec3_t albedo = get_diffuse_color(scene, hit);
+#if defined(PT_GUIDING)
+            const dtree_t *guide = guiding_lookup(scene->guiding, hit.position, nl);
+#else
+            const dtree_t *guide = nullptr;
+#endif
+
+#if defined(PT_NEE)
+            // The light segment must fit in the depth budget, as for a bounce
+            if (i + 1 < PT_MAX_DEPTH) {
+                vec3_t light = mask * albedo * sample_direct_light(scene, hit.position, nl, true,
+                                                                   guide);
+                color += light;
+                if (direct && i == 0)
+                    *direct += light;
+            }
+#endif
+
+            float pdf;
+            float weight = sample_bounce(guide, nl, &ray.direction, &pdf);
+            ray.origin = hit.position + nl * F_EPSYLON;
+#if defined(PT_NEE)
+            bsdf_pdf = pdf;
+#endif
+            if (weight <= 0.f)
+                break;
+
+            // (albedo / PI) * cos / pdf
+            mask *= albedo * weight;
 
-            ray.direction = get_hemisphere_random(hit.normal);
-            ray.origin = hit.position + hit.normal * F_EPSYLON;
+#if defined(PT_GUIDING)
+            // Before the roulette: the radiance of the surviving paths is
+            // scaled up to make up for the others.
+            if (records)
+                bounces[bounce_count++] = { hit.position, nl, ray.direction, color, mask,
+                                            dot(ray.direction, nl) / pdf };
+#endif
 
-            mask *= get_diffuse_color(scene, hit);
-            mask *= dot(ray.direction, nl);
-            mask *= 2.0f;
+            if (i + 1 >= PT_RR_MIN_DEPTH && !russian_roulette(mask))
+                break;
         }
 
+#if defined(PT_GUIDING)
+        // Radiance gathered past a bounce, over the throughput it arrives with
+        for (uint32_t b = 0; b < bounce_count; b++) {
+            const guided_vertex_t& v = bounces[b];
+            vec3_t gathered = color - v.color;
+            float radiance = (v.mask.r > 0.f ? gathered.r / v.mask.r : 0.f)
+                           + (v.mask.g > 0.f ? gathered.g / v.mask.g : 0.f)
+                           + (v.mask.b > 0.f ? gathered.b / v.mask.b : 0.f);
+            records->push_back({ v.position, v.normal, v.direction, radiance * v.cos_pdf / 3.f });
+        }
+#endif
         return color;
     }
 
-    static void mdt_light_cast(scene_t *scene, light_t *l, uint64_t depth)
+    vec3_t pathtrace(scene_t *scene, ray_t ray)
     {
-        for (uint64_t i = 0; i < IR_RAY_PER_LIGHT; i++) {
-            ray_t r;
-            hit_t hit;
-
-            if (l->type == object_type_e::AREA_LIGHT) {
-                area_light_t *al = static_cast<area_light_t*>(l);
+        return trace_path(scene, ray, nullptr, nullptr);
+    }
 
-                r.origin = al->position + al->normal * F_EPSYLON;
-                r.direction = get_hemisphere_random(al->normal);
-            }
-            else {
-                r.origin - l->position;
-                r.direction = get_sphere_random();
-            }
+    vec3_t pathtrace_recorded(scene_t *scene, ray_t ray, std::vector<guiding_record_t>& records)
+    {
+        return trace_path(scene, ray, &records, nullptr);
+    }
 
-            if (!intersect_scene(scene, r, &hit)) {
-                continue;
-            }
+    vec3_t pathtrace_split(scene_t *scene, ray_t ray, vec3_t *direct)
+    {
+        return trace_path(scene, ray, nullptr, direct);
+    }
 
-            if (hit.object->type == object_type_e::AREA_LIGHT) {
-                continue;
-            }
+#if defined(PT_IRRADIANCE_CACHE)
+    vec3_t pathtrace_cached(scene_t *scene, ray_t ray)
+    {
+        hit_t hit;
+        vec3_t irradiance;
 
-            light_t new_light;
-            float dist_to_light = magnitude(hit.position - r.origin);
+        if (!intersect_scene(scene, ray, &hit, RAY_PRIMARY))
+            return BLACK;
 
-            new_light.position = hit.position + hit.normal * 2.f * F_EPSYLON;
-            new_light.mlt.emission = l->mlt.emission * get_diffuse_color(scene, hit);
-            new_light.power = l->power / (dist_to_light * dist_to_light);
+        if (hit.object->type == object_type_e::AREA_LIGHT) {
+            area_light_t *l = static_cast<area_light_t*>(hit.object);
+            return l->mlt.emission * l->power;
+        }
 
-            scene->mdt_lights.push_back(new_light);
+        vec3_t nl = hit.normal;
+        nl *= dot(hit.normal, ray.direction) < 0 ? 1.0f : -1.0f;
 
-            if (depth < IR_RAY_DEPTH)
-                mdt_light_cast(scene, &scene->mdt_lights[scene->mdt_lights.size() - 1], depth + 1);
-        }
-    }
+        // Not covered by the cache: plain path tracing
+        if (!irradiance_cache_lookup(scene->irradiance_cache, hit.position, nl, &irradiance))
+            return pathtrace(scene, ray);
 
-    void mdt_generate_irradiance_lights(scene_t *scene)
-    {
-        for (object_t *o : scene->objects) {
-            if (o->type != object_type_e::AREA_LIGHT)
-                continue;
-            mdt_light_cast(scene, static_cast<light_t*>(o), 1);
-        }
-        printf("Created %zu lights\n", scene->mdt_lights.size());
+        vec3_t direct = sample_direct_light(scene, hit.position, nl, false, nullptr);
+        return get_diffuse_color(scene, hit) * (direct + irradiance * (1.f / PI));
     }
+#endif
 
-    vec3_t mdt(scene_t *scene, ray_t ray)
+    // Traces one ray from `l`, records the light it creates and casts again
+    // from there while depth allows. The new light stays on the stack while
+    // recursing: `out` may reallocate as it grows.
+    static void mdt_light_ray(scene_t *scene, const light_t *l, uint64_t depth,
+                              std::vector<light_t>& out)
     {
+        ray_t r;
         hit_t hit;
 
-        if (!intersect_scene(scene, ray, &hit))
-            return vec3_t(0.0f, 0.0f, 0.0f);
+        if (l->type == object_type_e::AREA_LIGHT) {
+            const area_light_t *al = static_cast<const area_light_t*>(l);
 
-        if (hit.object->type == object_type_e::AREA_LIGHT)
-            return hit.object->mlt.emission;
+            vec3_t n = area_light_normal(al);
+            r.origin = al->position + n * F_EPSYLON;
+            r.direction = get_hemisphere_random(n);
+        }
+        else {
+            r.origin = l->position;
+            r.direction = get_sphere_random();
+        }
 
-        vec3_t light = BLACK;
-        uint64_t l_count = scene->mdt_lights.size();
+        if (!intersect_scene(scene, r, &hit, RAY_BOUNCE))
+            return;
 
-        for (uint64_t i = 0; i < l_count; i++) {
-            hit_t l_hit;
-            ray_t l_ray;
+        if (hit.object->type == object_type_e::AREA_LIGHT)
+            return;
 
-            l_ray.origin = hit.position + hit.normal * F_EPSYLON;
-            l_ray.direction = normalize(scene->mdt_lights[i].position - l_ray.origin);
+        light_t new_light = light_t();
+        float dist_to_light = magnitude(hit.position - r.origin);
 
-            if (!intersect_scene(scene, l_ray, &l_hit))
-                continue;
+        new_light.position = hit.position + hit.normal * 2.f * F_EPSYLON;
+        new_light.mlt.emission = l->mlt.emission * get_diffuse_color(scene, hit);
+        new_light.power = l->power / (dist_to_light * dist_to_light);
 
-            vec3_t oh = l_hit.position - l_ray.origin;
-            vec3_t ol = scene->mdt_lights[i].position - l_ray.origin;
-            float dist_to_light = magnitude(ol);
-            if (magnitude(oh) < dist_to_light) // No direct sight
-                continue;
+        out.push_back(new_light);
 
-            float factor = 1.f / l_count;
-            light += scene->mdt_lights[i].mlt.emission * factor;
+        if (depth < IR_RAY_DEPTH) {
+            for (uint64_t i = 0; i < IR_RAY_PER_LIGHT; i++)
+                mdt_light_ray(scene, &new_light, depth + 1, out);
         }
-
-        return saturate(light) * get_diffuse_color(scene, hit);
     }
 
-    vec3_t bidir_pathtrace(scene_t *scene, ray_t ray)
+    void mdt_generate_irradiance_lights(scene_t *scene, uint32_t thread_count, uint64_t seed)
     {
-        vec3_t mask = WHITE;
-        vec3_t color = BLACK;
+        // One job per ray leaving a scene light, each with its own random
+        // stream and output buffer.
+        uint32_t job_count = scene->lights.size() * IR_RAY_PER_LIGHT;
+        std::vector<std::vector<light_t>> created(job_count);
+        std::atomic<uint32_t> next_job(0);
+        std::vector<std::thread> threads;
+
+        auto work = [&]() {
+            for (uint32_t j = next_job++; j < job_count; j = next_job++) {
+                seed_random(seed ^ (j * 0x9e3779b97f4a7c15ULL));
+                mdt_light_ray(scene, scene->lights[j / IR_RAY_PER_LIGHT], 1, created[j]);
+            }
+        };
+
+        for (uint32_t i = 0; i < std::max(1u, thread_count); i++)
+            threads.emplace_back(work);
+        for (std::thread& t : threads)
+            t.join();
+
+        // Merged in job order: the lights do not depend on the scheduling
+        size_t total = 0;
+        for (const std::vector<light_t>& c : created)
+            total += c.size();
+
+        scene->mdt_lights.clear();
+        scene->mdt_lights.reserve(total);
+        for (const std::vector<light_t>& c : created)
+            scene->mdt_lights.insert(scene->mdt_lights.end(), c.begin(), c.end());
+        printf("Created %zu lights\n", scene->mdt_lights.size());
 
-        for (uint32_t i = 0; i < BDPT_MAX_CRAY_DEPTH; i++) {
-            hit_t hit;
+#if defined(MDT_LIGHT_SAMPLES)
+        std::vector<float> intensity;
+        for (const light_t& l : scene->mdt_lights)
+            intensity.push_back(max_component(l.mlt.emission));
+        alias_table_build(scene->mdt_light_distribution, intensity);
+#endif
 
-            if (!intersect_scene(scene, ray, &hit)) {
-                color = BLACK;
-                break;
-            }
+#if defined(MDT_LIGHTCUTS)
+        seed_random(seed);
+        lightcuts_build(scene);
+#endif
+    }
 
-            if (hit.object->type == object_type_e::AREA_LIGHT) {
-                area_light_t *l = static_cast<area_light_t*>(hit.object);
-                color += mask * l->mlt.emission * l->power;
-                break;
-            }
+    bool mdt_light_visible(scene_t *scene, vec3_t origin, vec3_t light)
+    {
+        hit_t l_hit;
+        ray_t l_ray;
 
-            vec3_t nl = hit.normal;
-            nl *= dot(hit.normal, ray.direction) < 0 ? 1.0f : -1.0f;
+        l_ray.origin = origin;
+        l_ray.direction = normalize(light - origin);
 
-            ray.direction = get_hemisphere_random(hit.normal);
-            ray.origin = hit.position + hit.normal * F_EPSYLON;
+        if (!intersect_scene(scene, l_ray, &l_hit, RAY_SHADOW))
+            return false;
 
-            mask *= get_diffuse_color(scene, hit);
-            mask *= dot(ray.direction, nl);
-            mask *= 2.0f;
+        vec3_t oh = l_hit.position - l_ray.origin;
+        vec3_t ol = light - l_ray.origin;
+        return magnitude(oh) >= magnitude(ol); // Direct sight
+    }
 
-            // If out of bounce, let's try to close the path
-            if (i + 1 < BDPT_MAX_CRAY_DEPTH)
-                continue;
+    vec3_t mdt(scene_t *scene, ray_t ray)
+    {
+        hit_t hit;
 
-            vec3_t light = BLACK;
-            for (light_t l : scene->mdt_lights) {
-                hit_t l_hit;
-                ray_t l_ray;
+        if (!intersect_scene(scene, ray, &hit, RAY_PRIMARY))
+            return vec3_t(0.0f, 0.0f, 0.0f);
 
-                l_ray.origin = hit.position + hit.normal * F_EPSYLON;
-                l_ray.direction = normalize(l.position - l_ray.origin);
+        if (hit.object->type == object_type_e::AREA_LIGHT)
+            return hit.object->mlt.emission;
 
-                if (!intersect_scene(scene, l_ray, &l_hit))
-                    continue;
+#if defined(MDT_LIGHT_SAMPLES)
+        vec3_t light = BLACK;
+        vec3_t origin = hit.position + hit.normal * F_EPSYLON;
+        const alias_table_t& table = scene->mdt_light_distribution;
 
-                vec3_t oh = l_hit.position - l_ray.origin;
-                vec3_t ol = l.position - l_ray.origin;
-                float dist_to_light = magnitude(ol);
-                if (magnitude(oh) < dist_to_light) // No direct sight
-                    continue;
+        for (uint32_t i = 0; i < MDT_LIGHT_SAMPLES && table.pdf.size(); i++) {
+            uint32_t id = alias_table_sample(table, rand_0_1());
+            const light_t& l = scene->mdt_lights[id];
 
-                float factor = 1.f / scene->mdt_lights.size();
-                light += l.mlt.emission * factor;
-            }
+            // Lights behind the surface are never in sight: skip the ray
+            if (dot(l.position - origin, hit.normal) <= 0.f)
+                continue;
+            if (!mdt_light_visible(scene, origin, l.position))
+                continue;
 
-            color += mask * light;
+            // emission / l_count, over the pick pdf and the sample count
+            float factor = 1.f / (table.pdf.size() * table.pdf[id] * MDT_LIGHT_SAMPLES);
+            light += l.mlt.emission * factor;
         }
+#elif defined(MDT_LIGHTCUTS)
+        vec3_t light = lightcuts_gather(scene, hit.position + hit.normal * F_EPSYLON, hit.normal);
+#else
+        vec3_t light = BLACK;
+        uint64_t l_count = scene->mdt_lights.size();
+        vec3_t origin = hit.position + hit.normal * F_EPSYLON;
 
-        return color;
+        for (uint64_t i = 0; i < l_count; i++) {
+            if (!mdt_light_visible(scene, origin, scene->mdt_lights[i].position))
+                continue;
+
+            float factor = 1.f / l_count;
+            light += scene->mdt_lights[i].mlt.emission * factor;
+        }
+#endif
+
+        return saturate(light) * get_diffuse_color(scene, hit);
     }
 }
@@ -5,16 +5,96 @@
 #include "types.hh"
 #include "framework.hh"
 #include "raytracing.hh"
+#include "stats.hh"
 
 namespace RE
 {
+    // Prepares `c` for a frame. Without `lens` it stays a pinhole whatever
+    // its lens radius.
+    void camera_init(camera_t& c, uint32_t width, uint32_t height, bool lens);
+    // Ray through the film position (fx, fy), in pixels from the top left
+    // corner, and the lens point (u, v) of the unit square
+    ray_t camera_ray(const camera_t& c, float fx, float fy, float u, float v);
+    // Through the film position (fx, fy) and a random lens point
+    ray_t get_ray_from_film(struct renderer_info& i, float fx, float fy);
+    // Through the center of the pixel, and a random lens point
     ray_t get_ray_from_camera(struct renderer_info& i, uint32_t x, uint32_t y);
+    // Pixel whose camera ray passes through `p`, false when off screen
+    bool get_pixel_from_camera(struct renderer_info& i, vec3_t p, uint32_t *x, uint32_t *y);
+    // Solid angle density of the camera rays around `direction`
+    float get_camera_pdf(struct renderer_info& i, vec3_t direction);
+
+    // Compiles scene->objects into scene->geometry, which intersect_scene
+    // traces against: to redo whenever an object changes. The hierarchies
+    // are built on up to thread_count threads.
+    void build_scene_geometry(scene_t *scene, uint32_t thread_count);
+    bool intersect_scene(scene_t *scene, ray_t ray, hit_t *out, ray_kind_e kind);
+
+    // The rectangle of constant y the rotation of `l` spans, as traced by
+    // intersect_scene: its extents, and the normal of its lit side
+    vec3_t area_light_extent(const area_light_t *l);
+    vec3_t area_light_normal(const area_light_t *l);
+    float area_light_area(const area_light_t *l);
+    vec3_t sample_area_light(area_light_t *l);
+
+    // Russian roulette on a path throughput: returns false when the path
+    // dies, otherwise rescales mask so the estimator stays unbiased.
+    bool russian_roulette(vec3_t& mask);
+
+    // Fills scene->lights from the emitters of scene->objects, and the
+    // distribution picking them proportionally to their power. Also
+    // numbers the objects.
+    void collect_lights(scene_t *scene);
+    area_light_t *pick_light(scene_t *scene);
+    float pick_light_pdf(scene_t *scene, light_t *l);
 
     vec3_t pathtrace(scene_t *scene, ray_t ray);
+    // Also appends the incident radiance found at each bounce
+    vec3_t pathtrace_recorded(scene_t *scene, ray_t ray, std::vector<guiding_record_t>& records);
+    // Also returns the light reaching through at most one bounce in `direct`
+    vec3_t pathtrace_split(scene_t *scene, ray_t ray, vec3_t *direct);
+
+    // Fills scene->guiding from training passes over `bounds`
+    void guiding_train(struct renderer_info& i, struct area bounds);
+    // Learned directions at `position`, nullptr when nothing was learned there
+    const dtree_t *guiding_lookup(const guiding_tree_t& g, vec3_t position, vec3_t normal);
+    vec3_t dtree_sample(const dtree_t& d);
+    float dtree_pdf(const dtree_t& d, vec3_t direction);
+    // Camera rays only: indirect light comes from scene->irradiance_cache
+    vec3_t pathtrace_cached(scene_t *scene, ray_t ray);
+
+    // Fills scene->irradiance_cache for the camera hits of `bounds`
+    void irradiance_cache_build(struct renderer_info& i, struct area bounds);
+    bool irradiance_cache_lookup(const irradiance_cache_t& cache, vec3_t p, vec3_t n,
+                                 vec3_t *irradiance);
     vec3_t raytrace(scene_t *scene, ray_t ray, uint32_t bounce);
 
-    void mdt_generate_irradiance_lights(scene_t *scene);
+    // Expects collect_lights() to have run. The result only depends on seed.
+    void mdt_generate_irradiance_lights(scene_t *scene, uint32_t thread_count, uint64_t seed);
     vec3_t mdt(scene_t *scene, ray_t ray);
+    bool mdt_light_visible(scene_t *scene, vec3_t origin, vec3_t light);
+
+    // Light tree over scene->mdt_lights, and its evaluation through a
+    // lightcut at a shading point.
+    void lightcuts_build(scene_t *scene);
+    vec3_t lightcuts_gather(scene_t *scene, vec3_t position, vec3_t normal);
+
+    // Emits `photons` photons into a new scene->photon_map
+    void photon_map_generate(scene_t *scene, uint32_t photons, uint32_t thread_count,
+                             uint64_t seed);
+    // Updates the pixel's progressive estimate with the current photon map
+    vec3_t photon_gather(struct renderer_info& i, uint32_t x, uint32_t y, ray_t ray);
+
+    // Metropolis light transport over `bounds`, added to i.film
+    void mlt_render(struct renderer_info& i, struct area bounds,
+                    std::vector<render_stats_t>& stats);
+
+    // Light tracing contributions are appended to `splats`, in frame pixels.
+    // `direct`, when set, receives the paths of at most two segments.
+    vec3_t bidir_pathtrace(struct renderer_info& i, ray_t ray, std::vector<splat_t>& splats,
+                           vec3_t *direct);
 
-    vec3_t bidir_pathtrace(scene_t *scene, ray_t ray);
+    // Depth, normal, albedo, object id and uv of the pixel centers of
+    // `bounds`, into i.aov_film
+    void aov_render_first_hit(struct renderer_info& i, struct area bounds);
 }
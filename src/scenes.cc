@@ -0,0 +1,286 @@
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "scenes.hh"
+
+#define RED vec3_t(0.98f,   0.2f, 0.0f)
+#define BLUE vec3_t(0.2f,   0.65f, 0.98f)
+#define GRAY vec3_t(0.8f,   0.8f, 0.8f)
+
+namespace RE
+{
+    object_plane_t *create_infinite_plane(vec3_t pt, vec3_t normal, material_t mlt)
+    {
+        object_plane_t *plane = new object_plane_t();
+        plane->type = object_type_e::PLANE;
+        plane->position = pt;
+        plane->normal = normal;
+        plane->mlt = mlt;
+
+        return plane;
+    }
+
+    object_sphere_t *create_sphere(vec3_t center, float rad, material_t mlt)
+    {
+        object_sphere_t *s = new object_sphere_t();
+        s->type = object_type_e::SPHERE;
+        s->position = center;
+        s->radius = rad;
+        s->mlt = mlt;
+
+        return s;
+    }
+
+    area_light_t *create_area_light(vec3_t pos, material_t mlt,
+                                    float power, float width, float length)
+    {
+        area_light_t *l = new area_light_t();
+        l->type = object_type_e::AREA_LIGHT;
+        l->position = pos;
+        l->mlt = mlt;
+        l->size = vec3_t(width, 0.0f, length);
+        l->power = power;
+
+        return l;
+    }
+
+    object_mesh_t *create_mesh(vec3_t position, vec3_t rotation, material_t mlt,
+                               vec3_t *vtx, vec3_t *uv, uint64_t vtx_count)
+    {
+        object_mesh_t *m = new object_mesh_t();
+        m->type = object_type_e::MESH;
+        m->position = position;
+        m->rotation = rotation;
+        m->mlt = mlt;
+        m->vtx = vtx;
+        m->uv = uv;
+        m->vtx_count = vtx_count;
+
+        return m;
+    }
+
+    object_mesh_t *create_plane(vec3_t position, vec3_t size, vec3_t rotation,
+                                material_t mlt)
+    {
+        vec3_t *vtx = new vec3_t[6];
+        vec3_t *uv = new vec3_t[6];
+
+        vtx[0] = vec3_t(-0.5f * size.x, -0.5f * size.y);
+        vtx[1] = vec3_t(-0.5f * size.x,  0.5f * size.y);
+        vtx[2] = vec3_t( 0.5f * size.x, -0.5f * size.y);
+        vtx[3] = vec3_t( 0.5f * size.x, -0.5f * size.y);
+        vtx[4] = vec3_t(-0.5f * size.x,  0.5f * size.y);
+        vtx[5] = vec3_t( 0.5f * size.x,  0.5f * size.y);
+
+        uv[0] = vec3_t(0, 0);
+        uv[1] = vec3_t(0, 1);
+        uv[2] = vec3_t(1, 0);
+        uv[3] = vec3_t(1, 0);
+        uv[4] = vec3_t(0, 1);
+        uv[5] = vec3_t(1, 1);
+
+        return create_mesh(position, rotation, mlt, vtx, uv, 6);
+    }
+
+    object_mesh_t *create_icosphere(vec3_t position, float rad, uint32_t subdivisions,
+                                    material_t mlt)
+    {
+        const float t = (1.f + sqrt(5.f)) / 2.f;
+        std::vector<vec3_t> pts = {
+            vec3_t(-1,  t,  0), vec3_t( 1,  t,  0), vec3_t(-1, -t,  0), vec3_t( 1, -t,  0),
+            vec3_t( 0, -1,  t), vec3_t( 0,  1,  t), vec3_t( 0, -1, -t), vec3_t( 0,  1, -t),
+            vec3_t( t,  0, -1), vec3_t( t,  0,  1), vec3_t(-t,  0, -1), vec3_t(-t,  0,  1),
+        };
+        std::vector<uint32_t> faces = {
+            0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+            1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+            3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+            4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1,
+        };
+
+        for (vec3_t& p : pts)
+            p = normalize(p);
+
+        for (uint32_t s = 0; s < subdivisions; s++) {
+            std::map<std::pair<uint32_t, uint32_t>, uint32_t> middles;
+            std::vector<uint32_t> next;
+
+            auto middle = [&](uint32_t a, uint32_t b) {
+                auto key = std::make_pair(std::min(a, b), std::max(a, b));
+                auto it = middles.find(key);
+                if (it != middles.end())
+                    return it->second;
+
+                pts.push_back(normalize((pts[a] + pts[b]) * 0.5f));
+                middles[key] = pts.size() - 1;
+                return (uint32_t)(pts.size() - 1);
+            };
+
+            for (size_t f = 0; f < faces.size(); f += 3) {
+                uint32_t a = faces[f + 0], b = faces[f + 1], c = faces[f + 2];
+                uint32_t ab = middle(a, b), bc = middle(b, c), ca = middle(c, a);
+                next.insert(next.end(), { a, ab, ca,  b, bc, ab,  c, ca, bc,  ab, bc, ca });
+            }
+            faces = next;
+        }
+
+        vec3_t *vtx = new vec3_t[faces.size()];
+        vec3_t *uv = new vec3_t[faces.size()];
+        for (size_t f = 0; f < faces.size(); f += 3) {
+            vec3_t a = pts[faces[f + 0]], b = pts[faces[f + 1]], c = pts[faces[f + 2]];
+
+            // Back faces are culled: make sure the winding faces outward
+            if (dot(cross(b - a, c - a), a + b + c) < 0)
+                std::swap(b, c);
+
+            vtx[f + 0] = a * rad;
+            vtx[f + 1] = b * rad;
+            vtx[f + 2] = c * rad;
+            uv[f + 0] = uv[f + 1] = uv[f + 2] = VECTOR_ZERO;
+        }
+
+        return create_mesh(position, VECTOR_ZERO, mlt, vtx, uv, faces.size());
+    }
+
+    static material_t diffuse_material(vec3_t color)
+    {
+        material_t m = material_t();
+        m.diffuse = color;
+        m.has_texture = false;
+        return m;
+    }
+
+    static material_t light_material(vec3_t color)
+    {
+        material_t m = material_t();
+        m.emission = color;
+        m.has_texture = false;
+        return m;
+    }
+
+    static void add_box(scene_t *scene)
+    {
+        material_t gray = diffuse_material(GRAY);
+        material_t white = diffuse_material(WHITE);
+        material_t red = diffuse_material(RED);
+        material_t blue = diffuse_material(BLUE);
+
+        scene->camera.position = vec3_t(0, 0, -15);
+        scene->camera.direction = vec3_t(0, 0, 1);
+        scene->camera.up = VECTOR_UP;
+        scene->camera.fov = 45.f;
+
+        scene->objects.push_back(create_plane(vec3_t(0, -5, 0), vec3_t(10.2, 10.2),
+                                              vec3_t(90, 0, 0), gray));
+        scene->objects.push_back(create_plane(vec3_t(0,  5, 0), vec3_t(10.2, 10.2),
+                                              vec3_t(-90, 0, 0), gray));
+        scene->objects.push_back(create_plane(vec3_t(0, 0, 5), vec3_t(10, 10),
+                                              vec3_t(0, 0, 0), white));
+        scene->objects.push_back(create_plane(vec3_t(5, 0, 0), vec3_t(10, 10),
+                                              vec3_t(0, 90, 0), blue));
+        scene->objects.push_back(create_plane(vec3_t(-5, 0, 0), vec3_t(10, 10),
+                                              vec3_t(0, -90, 0), red));
+    }
+
+    void scene_cornell_box(scene_t *scene)
+    {
+        material_t white = diffuse_material(WHITE);
+
+        scene->objects.push_back(create_sphere(vec3_t(2, -3.5, -1), 1.5f, white));
+        scene->objects.push_back(create_sphere(vec3_t(-2, -3.0, 3.5), 2.0f, white));
+        add_box(scene);
+        scene->objects.push_back(create_area_light(vec3_t(0, 4.5f, -1), light_material(WHITE),
+                                                   5.0, 5, 5));
+    }
+
+    void scene_many_spheres(scene_t *scene)
+    {
+        material_t white = diffuse_material(WHITE);
+        material_t gray = diffuse_material(GRAY);
+
+        for (int z = 0; z < 5; z++) {
+            for (int x = 0; x < 5; x++) {
+                vec3_t c(-4.f + x * 2.f, -4.4f + z * 0.4f, -2.f + z * 1.5f);
+                scene->objects.push_back(create_sphere(c, 0.6f, (x + z) & 1 ? white : gray));
+            }
+        }
+        add_box(scene);
+        scene->objects.push_back(create_area_light(vec3_t(0, 4.5f, -1), light_material(WHITE),
+                                                   5.0, 5, 5));
+    }
+
+    void scene_high_poly_mesh(scene_t *scene)
+    {
+        material_t white = diffuse_material(WHITE);
+
+        scene->objects.push_back(create_icosphere(vec3_t(0, -2.5f, 1), 2.5f, 6, white));
+        add_box(scene);
+        scene->objects.push_back(create_area_light(vec3_t(0, 4.5f, -1), light_material(WHITE),
+                                                   5.0, 5, 5));
+    }
+
+    void scene_many_lights(scene_t *scene)
+    {
+        material_t white = diffuse_material(WHITE);
+        const vec3_t colors[] = {
+            WHITE, vec3_t(1.f, 0.6f, 0.3f), vec3_t(0.3f, 0.6f, 1.f), vec3_t(0.6f, 1.f, 0.6f)
+        };
+
+        scene->objects.push_back(create_sphere(vec3_t(2, -3.5, -1), 1.5f, white));
+        scene->objects.push_back(create_sphere(vec3_t(-2, -3.0, 3.5), 2.0f, white));
+        add_box(scene);
+        for (uint32_t i = 0; i < 4; i++) {
+            vec3_t pos(i & 1 ? 2.5f : -2.5f, 4.5f, i & 2 ? 2.5f : -2.5f);
+            scene->objects.push_back(create_area_light(pos, light_material(colors[i]),
+                                                       3.0, 1.5, 1.5));
+        }
+    }
+
+    void scene_indirect(scene_t *scene)
+    {
+        material_t white = diffuse_material(WHITE);
+
+        // The light is behind a partition and faces the floor: the room only
+        // gets what bounces through the gap above it.
+        scene->objects.push_back(create_sphere(vec3_t(2, -3.5, -1), 1.5f, white));
+        scene->objects.push_back(create_sphere(vec3_t(-2, -3.0, 0.5), 2.0f, white));
+        scene->objects.push_back(create_plane(vec3_t(0, -1, 3), vec3_t(10, 8),
+                                              vec3_t(0, 0, 0), white));
+        add_box(scene);
+        scene->objects.push_back(create_area_light(vec3_t(0, 0, 4), light_material(WHITE),
+                                                   100.0, 3, 1.5));
+    }
+
+    void destroy_scene(scene_t *scene)
+    {
+        for (object_t *o : scene->objects) {
+            switch (o->type) {
+                case object_type_e::SPHERE:
+                    delete static_cast<object_sphere_t*>(o);
+                    break;
+                case object_type_e::PLANE:
+                    delete static_cast<object_plane_t*>(o);
+                    break;
+                case object_type_e::MESH:
+                    delete[] static_cast<object_mesh_t*>(o)->vtx;
+                    delete[] static_cast<object_mesh_t*>(o)->uv;
+                    delete static_cast<object_mesh_t*>(o);
+                    break;
+                case object_type_e::AREA_LIGHT:
+                    delete static_cast<area_light_t*>(o);
+                    break;
+            }
+        }
+
+        scene->objects.clear();
+        scene->lights.clear();
+        scene->mdt_lights.clear();
+        scene->mdt_light_tree.clear();
+        scene->light_distribution = alias_table_t();
+        scene->mdt_light_distribution = alias_table_t();
+        scene->photon_map = photon_map_t();
+        scene->irradiance_cache = irradiance_cache_t();
+        scene->guiding = guiding_tree_t();
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "types.hh"
+#include "vectors.hh"
+
+namespace RE
+{
+    // Objects are heap allocated and owned by the scene: release them
+    // with destroy_scene().
+    object_plane_t *create_infinite_plane(vec3_t pt, vec3_t normal, material_t mlt);
+    object_sphere_t *create_sphere(vec3_t center, float rad, material_t mlt);
+    area_light_t *create_area_light(vec3_t pos, material_t mlt,
+                                    float power, float width, float length);
+    object_mesh_t *create_mesh(vec3_t position, vec3_t rotation, material_t mlt,
+                               vec3_t *vtx, vec3_t *uv, uint64_t vtx_count);
+    object_mesh_t *create_plane(vec3_t position, vec3_t size, vec3_t rotation,
+                                material_t mlt);
+    object_mesh_t *create_icosphere(vec3_t position, float rad, uint32_t subdivisions,
+                                    material_t mlt);
+
+    // Canonical scenes, all built around the same closed box
+    void scene_cornell_box(scene_t *scene);
+    void scene_many_spheres(scene_t *scene);
+    void scene_high_poly_mesh(scene_t *scene);
+    void scene_many_lights(scene_t *scene);
+    void scene_indirect(scene_t *scene);
+
+    void destroy_scene(scene_t *scene);
+}
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <assert.h>
+#include <mutex>
+#include <queue>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "defines.hh"
+#include "denoise.hh"
+#include "framework.hh"
+#include "heatmap.hh"
+#include "renderer.hh"
+#include "scoped_timer.hh"
+#include "stats.hh"
+
+namespace RE
+{
+    // Variance of the luminance of a pixel mean, from the second moment of
+    // its samples
+    static float mean_variance(vec3_t mean, float moment2, uint32_t samples)
+    {
+        float l = luminance(mean);
+        return std::max(0.f, moment2 - l * l) / samples;
+    }
+
+    static void write_split(struct renderer_info& i, uint32_t x, uint32_t y, vec3_t color,
+                            vec3_t direct)
+    {
+        aov_write(*i.aov_film, AOV_DIRECT, x, y, direct);
+        aov_write(*i.aov_film, AOV_INDIRECT, x, y, color - direct);
+    }
+
+    // The film (when there is one) gets the color before it is clamped.
+    // Sampling integrators draw a film position and a lens point per sample,
+    // and spread it over the tile film of `tf`; they return the plain mean
+    // of the pixel's own samples.
+    static vec3_t render_pixel(struct renderer_info& i, uint32_t x, uint32_t y, vec3_t *splat,
+                               tile_film_t& tf)
+    {
+        bool split = i.aov_film && (aov_enabled(*i.aov_film, AOV_DIRECT)
+                                    || aov_enabled(*i.aov_film, AOV_INDIRECT));
+
+        switch (i.integrator) {
+            case integrator_e::MDT:
+                return mdt(i.scene, get_ray_from_camera(i, x, y));
+            case integrator_e::RAYTRACER:
+                return raytrace(i.scene, get_ray_from_camera(i, x, y), 0);
+            case integrator_e::PATHTRACER:
+            {
+                vec3_t out = BLACK;
+#if !defined(PT_IRRADIANCE_CACHE)
+                vec3_t direct = BLACK;
+#endif
+                float moment2 = 0.f;
+                for (uint32_t s = 0; s < i.samples; s++) {
+                    float fx = x + rand_0_1();
+                    float fy = y + rand_0_1();
+                    ray_t r = get_ray_from_film(i, fx, fy);
+#if defined(PT_IRRADIANCE_CACHE)
+                    // The cache has no direct / indirect split
+                    vec3_t L = pathtrace_cached(i.scene, r);
+#else
+                    vec3_t d;
+                    vec3_t L = split ? pathtrace_split(i.scene, r, &d) : pathtrace(i.scene, r);
+                    if (split)
+                        direct = direct + d * (1.0f / i.samples);
+#endif
+                    tile_film_add(tf, i.filter, fx, fy, L);
+                    out = out + L * (1.0f / i.samples);
+                    moment2 += luminance(L) * luminance(L) * (1.0f / i.samples);
+                }
+                if (i.variance)
+                    i.variance[x + y * i.width] = mean_variance(out, moment2, i.samples);
+#if !defined(PT_IRRADIANCE_CACHE)
+                if (split)
+                    write_split(i, x, y, out, direct);
+#endif
+                return out;
+            }
+            case integrator_e::BIDIR_PATHTRACER:
+            {
+                vec3_t out = BLACK;
+                vec3_t direct = BLACK;
+                float moment2 = 0.f;
+                std::vector<splat_t> splats;
+                for (uint32_t s = 0; s < i.samples; s++) {
+                    float fx = x + rand_0_1();
+                    float fy = y + rand_0_1();
+                    ray_t r = get_ray_from_film(i, fx, fy);
+                    vec3_t d;
+                    vec3_t L = bidir_pathtrace(i, r, splats, split ? &d : nullptr);
+                    if (split)
+                        direct = direct + d * (1.0f / i.samples);
+                    tile_film_add(tf, i.filter, fx, fy, L);
+                    out = out + L * (1.0f / i.samples);
+                    moment2 += luminance(L) * luminance(L) * (1.0f / i.samples);
+                }
+                for (const splat_t& sp : splats)
+                    splat[sp.pixel] += sp.value;
+
+                // Light tracing splats are resolved once all tiles are done,
+                // and are left out of the split.
+                if (i.variance)
+                    i.variance[x + y * i.width] = mean_variance(out, moment2, i.samples);
+                if (split)
+                    write_split(i, x, y, out, direct);
+                return out;
+            }
+            case integrator_e::PHOTON_MAPPER:
+                return photon_gather(i, x, y, get_ray_from_camera(i, x, y));
+            case integrator_e::MLT:
+                break;
+        }
+
+        assert(0 && "Unknown integrator");
+        return BLACK;
+    }
+
+    struct job {
+        uint32_t x, y, width, height;
+        uint32_t id;
+    };
+
+    static void render_tile(struct renderer_info& i, const struct job& j, vec3_t *splat)
+    {
+        // Each tile gets its own stream: the image does not depend on
+        // which thread picked the tile up.
+        seed_random(i.seed ^ (j.id * 0x9e3779b97f4a7c15ULL));
+
+        // Counted once per pass by the photon mapper
+        bool sampled = i.integrator != integrator_e::RAYTRACER
+                    && i.integrator != integrator_e::MDT;
+        float samples = sampled ? i.samples : 1;
+
+        tile_film_t unused;
+        tile_film_t& tf = i.tile_films ? i.tile_films[j.id] : unused;
+        if (i.tile_films)
+            tile_film_init(tf, i.filter, { j.x, j.y, j.width, j.height });
+
+        uint32_t x_lim = std::min(i.width, j.x + j.width);
+        uint32_t y_lim = std::min(i.height, j.y + j.height);
+        for (uint32_t y = j.y; y < y_lim; y++) {
+            for (uint32_t x = j.x; x < x_lim; x++) {
+                vec3_t px = render_pixel(i, x, y, splat, tf);
+                if (i.film)
+                    i.film[x + y * i.width] = px;
+                if (i.aov_film)
+                    aov_write(*i.aov_film, AOV_SAMPLES, x, y, vec3_t(samples));
+                px = saturate(px);
+
+                i.output_frame[(x + y * i.width) * STRIDE + 0] = px.r * 255.0;
+                i.output_frame[(x + y * i.width) * STRIDE + 1] = px.g * 255.0;
+                i.output_frame[(x + y * i.width) * STRIDE + 2] = px.b * 255.0;
+                i.output_frame[(x + y * i.width) * STRIDE + 3] = 255;
+            }
+        }
+    }
+
+    static void worker_loop(struct renderer_info& i, std::queue<struct job>& q, std::mutex& m,
+                            vec3_t *splat)
+    {
+        while (!q.empty()) {
+            m.lock();
+            if (q.empty()) {
+                m.unlock();
+                return;
+            }
+
+            struct job j = q.front();
+            q.pop();
+            m.unlock();
+
+            // Adds up over the passes of the photon mapper
+            uint64_t rays = stats_total_rays(thread_stats);
+            float time = 0.f;
+            {
+                scoped_timer_t timer(time);
+                render_tile(i, j, splat);
+            }
+            i.tile_costs[j.id].time += time;
+            i.tile_costs[j.id].rays += stats_total_rays(thread_stats) - rays;
+        }
+    }
+
+    static void worker(struct renderer_info& i, std::queue<struct job>& q, std::mutex& m,
+                       render_stats_t& stats, std::vector<vec3_t>& splat)
+    {
+        thread_stats = render_stats_t();
+        {
+            scoped_timer_t timer(thread_stats.busy_time);
+            worker_loop(i, q, m, splat.data());
+        }
+        stats_merge(stats, thread_stats);
+    }
+
+    float render_frame(struct renderer_info& info, struct area *area)
+    {
+        collect_lights(info.scene);
+        build_scene_geometry(info.scene, info.thread_count);
+
+        // Light tracing connects to a pinhole
+        bool light_tracing = info.integrator == integrator_e::BIDIR_PATHTRACER;
+#if defined(MLT_BIDIR)
+        light_tracing |= info.integrator == integrator_e::MLT;
+#endif
+        camera_init(info.scene->camera, info.width, info.height, !light_tracing);
+        if (light_tracing && info.scene->camera.lens_radius > 0.f)
+            puts("Light tracing ignores the lens: rendering through a pinhole");
+
+        if (info.integrator == integrator_e::MDT)
+            mdt_generate_irradiance_lights(info.scene, info.thread_count, info.seed);
+
+        std::vector<struct job> tiles;
+        std::queue<struct job> jobs;
+        std::vector<std::thread> threads(0);
+        std::mutex lock;
+
+        uint32_t x0 = area ? area->x : 0;
+        uint32_t y0 = area ? area->y : 0;
+        uint32_t x1 = std::min(info.width, area ? area->x + area->w : info.width);
+        uint32_t y1 = std::min(info.height, area ? area->y + area->h : info.height);
+
+#if defined(PT_GUIDING)
+        if (info.integrator == integrator_e::PATHTRACER)
+            guiding_train(info, { x0, y0, x1 - x0, y1 - y0 });
+#endif
+#if defined(PT_IRRADIANCE_CACHE)
+        if (info.integrator == integrator_e::PATHTRACER)
+            irradiance_cache_build(info, { x0, y0, x1 - x0, y1 - y0 });
+#endif
+
+        std::vector<tile_cost_t> tile_costs;
+        for (uint32_t y = y0; y < y1; y += TILE_SIZE) {
+            for (uint32_t x = x0; x < x1; x += TILE_SIZE) {
+                uint32_t w = std::min<uint32_t>(TILE_SIZE, x1 - x);
+                uint32_t h = std::min<uint32_t>(TILE_SIZE, y1 - y);
+                struct job j = { x, y, w, h, (uint32_t)tile_costs.size() };
+
+                tiles.push_back(j);
+                tile_costs.push_back({ x, y, w, h, 0.f, 0 });
+            }
+        }
+        info.tile_costs = tile_costs.data();
+
+        // Light tracing writes anywhere on the frame: each thread splats in
+        // its own buffer, merged after the join.
+        bool splatting = info.integrator == integrator_e::BIDIR_PATHTRACER;
+        std::vector<vec3_t> splat(splatting ? info.width * info.height : 0);
+        std::vector<std::vector<vec3_t>> splats(info.thread_count, splat);
+
+        // Samples spread over the neighbouring pixels, across tile borders:
+        // each tile accumulates in its own film, merged in tile order once
+        // they are all done.
+        bool sampled = info.integrator == integrator_e::PATHTRACER
+                    || info.integrator == integrator_e::BIDIR_PATHTRACER;
+        std::vector<tile_film_t> tile_films(sampled ? tiles.size() : 0);
+        info.tile_films = tile_films.empty() ? nullptr : tile_films.data();
+
+        // Metropolis light transport has no tiles, it only fills the film
+        bool metropolis = info.integrator == integrator_e::MLT;
+        std::vector<vec3_t> film(sampled || metropolis || info.denoise
+                                 ? info.width * info.height : 0);
+        info.film = film.empty() ? nullptr : film.data();
+
+        // The denoiser trusts the noise measured over the samples, where
+        // the integrator has some
+        std::vector<float> variance(info.denoise && sampled ? info.width * info.height : 0);
+        info.variance = variance.empty() ? nullptr : variance.data();
+
+        // The denoiser is guided by the first hit. Without a film from the
+        // caller, the channels live until the end of the frame.
+        uint32_t aovs = info.aovs;
+        if (info.denoise)
+            aovs |= aov_bit(AOV_DEPTH) | aov_bit(AOV_NORMAL) | aov_bit(AOV_ALBEDO);
+        aov_film_t own_aovs;
+        aov_film_t *aov_film = info.aov_film ? info.aov_film : &own_aovs;
+        aov_film_init(*aov_film, info.width, info.height, aovs);
+        info.aov_film = aovs ? aov_film : nullptr;
+        if (aovs & AOV_FIRST_HIT)
+            aov_render_first_hit(info, { x0, y0, x1 - x0, y1 - y0 });
+
+        // Progressive photon mapping renders the frame once per pass
+        bool photons = info.integrator == integrator_e::PHOTON_MAPPER;
+        uint32_t passes = photons ? info.samples : (metropolis ? 0 : 1);
+        std::vector<photon_pixel_t> photon_pixels(photons ? info.width * info.height : 0);
+        info.photon_pixels = photon_pixels.data();
+        info.scene->photon_map = photon_map_t();
+
+        std::vector<render_stats_t> stats(info.thread_count);
+        float wall_time = 0.f;
+        {
+            scoped_timer_t timer(wall_time);
+
+            if (metropolis)
+                mlt_render(info, { x0, y0, x1 - x0, y1 - y0 }, stats);
+
+            for (uint32_t pass = 0; pass < passes; pass++) {
+                if (photons)
+                    photon_map_generate(info.scene, PM_PHOTONS, info.thread_count,
+                                        (info.seed + pass + 1) * 0xbf58476d1ce4e5b9ULL);
+
+                for (const struct job& j : tiles)
+                    jobs.push(j);
+
+                for (uint32_t i = 0; i < info.thread_count; i++)
+                    threads.emplace_back(worker, std::ref(info), std::ref(jobs), std::ref(lock),
+                                         std::ref(stats[i]), std::ref(splats[i]));
+
+                for (uint32_t i = 0; i < info.thread_count; i++)
+                    threads[i].join();
+                threads.clear();
+            }
+        }
+        info.tile_costs = nullptr;
+        info.tile_films = nullptr;
+        info.film = nullptr;
+        info.variance = nullptr;
+        info.photon_pixels = nullptr;
+
+        if (sampled)
+            film_resolve(tile_films, { x0, y0, x1 - x0, y1 - y0 }, info.width, info.height,
+                         film.data());
+
+        if (splatting) {
+            // One light path per camera sample of the rendered area, but the
+            // camera importance is normalized over the whole frame.
+            float scale = (float)(info.width * info.height)
+                        / ((x1 - x0) * (y1 - y0) * info.samples);
+
+            for (uint32_t y = y0; y < y1; y++) {
+                for (uint32_t x = x0; x < x1; x++) {
+                    uint32_t p = x + y * info.width;
+                    for (uint32_t t = 0; t < splats.size(); t++)
+                        film[p] += splats[t][p] * scale;
+                }
+            }
+        }
+
+        if (info.denoise) {
+            float time = 0.f;
+            {
+                scoped_timer_t timer(time);
+                denoise(info, { x0, y0, x1 - x0, y1 - y0 }, film.data(),
+                        variance.empty() ? nullptr : variance.data(), *aov_film);
+            }
+            printf("Denoised in %.3fs\n", time);
+        }
+
+        if (!film.empty()) {
+            for (uint32_t y = y0; y < y1; y++) {
+                for (uint32_t x = x0; x < x1; x++) {
+                    uint32_t p = x + y * info.width;
+                    vec3_t px = saturate(film[p]);
+
+                    info.output_frame[p * STRIDE + 0] = px.r * 255.0;
+                    info.output_frame[p * STRIDE + 1] = px.g * 255.0;
+                    info.output_frame[p * STRIDE + 2] = px.b * 255.0;
+                    // MLT renders no tiles, nothing else writes it
+                    info.output_frame[p * STRIDE + 3] = 255;
+                }
+            }
+        }
+
+        info.aov_film = aov_film == &own_aovs ? nullptr : aov_film;
+
+        stats_report(stats, info.scene->geometry.build_time, wall_time);
+#if defined(RENDER_HEATMAP)
+        heatmap_write(RENDER_HEATMAP, tile_costs, info.width, info.height);
+#endif
+
+        return wall_time;
+    }
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <chrono>
 
 typedef struct scoped_timer
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <immintrin.h>
+#include <stdint.h>
+
+// Float vectors as wide as the target allows: 16 lanes with AVX-512, 8 with
+// AVX2, 4 with SSE2 otherwise. Configure with -DNATIVE=ON to get the wide
+// ones on the build machine.
+
+namespace RE
+{
+#if defined(__AVX512F__)
+    #define SIMD_WIDTH 16
+
+    typedef __m512 vfloat_t;
+    typedef __mmask16 vmask_t;
+
+    inline vfloat_t v_set1(float a) { return _mm512_set1_ps(a); }
+    inline vfloat_t v_load(const float *p) { return _mm512_loadu_ps(p); }
+    inline void v_store(float *p, vfloat_t a) { _mm512_storeu_ps(p, a); }
+
+    inline vfloat_t v_add(vfloat_t a, vfloat_t b) { return _mm512_add_ps(a, b); }
+    inline vfloat_t v_sub(vfloat_t a, vfloat_t b) { return _mm512_sub_ps(a, b); }
+    inline vfloat_t v_mul(vfloat_t a, vfloat_t b) { return _mm512_mul_ps(a, b); }
+    inline vfloat_t v_div(vfloat_t a, vfloat_t b) { return _mm512_div_ps(a, b); }
+    // The zero-masked forms: GCC 12 warns about the undefined source of
+    // the plain ones
+    inline vfloat_t v_min(vfloat_t a, vfloat_t b) { return _mm512_maskz_min_ps(0xffff, a, b); }
+    inline vfloat_t v_max(vfloat_t a, vfloat_t b) { return _mm512_maskz_max_ps(0xffff, a, b); }
+    inline vfloat_t v_sqrt(vfloat_t a) { return _mm512_maskz_sqrt_ps(0xffff, a); }
+
+    inline vmask_t v_lt(vfloat_t a, vfloat_t b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    inline vmask_t v_le(vfloat_t a, vfloat_t b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    inline vmask_t v_ge(vfloat_t a, vfloat_t b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    inline vmask_t v_ne(vfloat_t a, vfloat_t b) { return _mm512_cmp_ps_mask(a, b, _CMP_NEQ_OQ); }
+    inline vmask_t v_and(vmask_t a, vmask_t b) { return a & b; }
+    inline vmask_t v_or(vmask_t a, vmask_t b) { return a | b; }
+    // a where m is set, b elsewhere
+    inline vfloat_t v_select(vmask_t m, vfloat_t a, vfloat_t b) { return _mm512_mask_blend_ps(m, b, a); }
+    inline uint32_t v_bits(vmask_t m) { return m; }
+#elif defined(__AVX2__)
+    #define SIMD_WIDTH 8
+
+    typedef __m256 vfloat_t;
+    typedef __m256 vmask_t;
+
+    inline vfloat_t v_set1(float a) { return _mm256_set1_ps(a); }
+    inline vfloat_t v_load(const float *p) { return _mm256_loadu_ps(p); }
+    inline void v_store(float *p, vfloat_t a) { _mm256_storeu_ps(p, a); }
+
+    inline vfloat_t v_add(vfloat_t a, vfloat_t b) { return _mm256_add_ps(a, b); }
+    inline vfloat_t v_sub(vfloat_t a, vfloat_t b) { return _mm256_sub_ps(a, b); }
+    inline vfloat_t v_mul(vfloat_t a, vfloat_t b) { return _mm256_mul_ps(a, b); }
+    inline vfloat_t v_div(vfloat_t a, vfloat_t b) { return _mm256_div_ps(a, b); }
+    inline vfloat_t v_min(vfloat_t a, vfloat_t b) { return _mm256_min_ps(a, b); }
+    inline vfloat_t v_max(vfloat_t a, vfloat_t b) { return _mm256_max_ps(a, b); }
+    inline vfloat_t v_sqrt(vfloat_t a) { return _mm256_sqrt_ps(a); }
+
+    inline vmask_t v_lt(vfloat_t a, vfloat_t b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    inline vmask_t v_le(vfloat_t a, vfloat_t b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    inline vmask_t v_ge(vfloat_t a, vfloat_t b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    inline vmask_t v_ne(vfloat_t a, vfloat_t b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
+    inline vmask_t v_and(vmask_t a, vmask_t b) { return _mm256_and_ps(a, b); }
+    inline vmask_t v_or(vmask_t a, vmask_t b) { return _mm256_or_ps(a, b); }
+    inline vfloat_t v_select(vmask_t m, vfloat_t a, vfloat_t b) { return _mm256_blendv_ps(b, a, m); }
+    inline uint32_t v_bits(vmask_t m) { return _mm256_movemask_ps(m); }
+#else
+    #define SIMD_WIDTH 4
+
+    typedef __m128 vfloat_t;
+    typedef __m128 vmask_t;
+
+    inline vfloat_t v_set1(float a) { return _mm_set1_ps(a); }
+    inline vfloat_t v_load(const float *p) { return _mm_loadu_ps(p); }
+    inline void v_store(float *p, vfloat_t a) { _mm_storeu_ps(p, a); }
+
+    inline vfloat_t v_add(vfloat_t a, vfloat_t b) { return _mm_add_ps(a, b); }
+    inline vfloat_t v_sub(vfloat_t a, vfloat_t b) { return _mm_sub_ps(a, b); }
+    inline vfloat_t v_mul(vfloat_t a, vfloat_t b) { return _mm_mul_ps(a, b); }
+    inline vfloat_t v_div(vfloat_t a, vfloat_t b) { return _mm_div_ps(a, b); }
+    inline vfloat_t v_min(vfloat_t a, vfloat_t b) { return _mm_min_ps(a, b); }
+    inline vfloat_t v_max(vfloat_t a, vfloat_t b) { return _mm_max_ps(a, b); }
+    inline vfloat_t v_sqrt(vfloat_t a) { return _mm_sqrt_ps(a); }
+
+    inline vmask_t v_lt(vfloat_t a, vfloat_t b) { return _mm_cmplt_ps(a, b); }
+    inline vmask_t v_le(vfloat_t a, vfloat_t b) { return _mm_cmple_ps(a, b); }
+    inline vmask_t v_ge(vfloat_t a, vfloat_t b) { return _mm_cmpge_ps(a, b); }
+    inline vmask_t v_ne(vfloat_t a, vfloat_t b) { return _mm_cmpneq_ps(a, b); }
+    inline vmask_t v_and(vmask_t a, vmask_t b) { return _mm_and_ps(a, b); }
+    inline vmask_t v_or(vmask_t a, vmask_t b) { return _mm_or_ps(a, b); }
+    inline vfloat_t v_select(vmask_t m, vfloat_t a, vfloat_t b)
+    {
+        return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+    }
+    inline uint32_t v_bits(vmask_t m) { return _mm_movemask_ps(m); }
+#endif
+
+    // a * b + c, fused when the target has FMA
+    inline vfloat_t v_madd(vfloat_t a, vfloat_t b, vfloat_t c)
+    {
+#if defined(__AVX512F__)
+        return _mm512_fmadd_ps(a, b, c);
+#elif defined(__AVX2__) && defined(__FMA__)
+        return _mm256_fmadd_ps(a, b, c);
+#else
+        return v_add(v_mul(a, b), c);
+#endif
+    }
+}
@@ -0,0 +1,99 @@
+#include <fstream>
+#include <stdio.h>
+
+#include "stats.hh"
+
+namespace RE
+{
+    thread_local render_stats_t thread_stats = render_stats_t();
+
+    static const char *ray_kind_names[RAY_KIND_COUNT] = {
+        "primary", "bounce", "shadow"
+    };
+
+    uint64_t stats_total_rays(const render_stats_t& s)
+    {
+        uint64_t total = 0;
+        for (uint32_t k = 0; k < RAY_KIND_COUNT; k++)
+            total += s.rays[k];
+        return total;
+    }
+
+    void stats_merge(render_stats_t& dst, const render_stats_t& src)
+    {
+        for (uint32_t k = 0; k < RAY_KIND_COUNT; k++)
+            dst.rays[k] += src.rays[k];
+        dst.primitive_tests += src.primitive_tests;
+        dst.node_traversals += src.node_traversals;
+        dst.busy_time += src.busy_time;
+    }
+
+#if defined(STATS_JSON_PATH)
+    static void stats_write_json(const std::vector<render_stats_t>& threads,
+                                 const render_stats_t& total, float build_time,
+                                 float wall_time)
+    {
+        std::ofstream out(STATS_JSON_PATH);
+        if (!out) {
+            fprintf(stderr, "Unable to write stats to %s\n", STATS_JSON_PATH);
+            return;
+        }
+
+        uint64_t rays = stats_total_rays(total);
+
+        out << "{\n";
+        out << "  \"build_time\": " << build_time << ",\n";
+        out << "  \"wall_time\": " << wall_time << ",\n";
+        out << "  \"mrays_per_sec\": " << rays / wall_time * 1e-6 << ",\n";
+        out << "  \"rays\": {";
+        for (uint32_t k = 0; k < RAY_KIND_COUNT; k++)
+            out << (k ? ", " : " ") << "\"" << ray_kind_names[k] << "\": " << total.rays[k];
+        out << " },\n";
+        out << "  \"primitive_tests\": " << total.primitive_tests << ",\n";
+        out << "  \"node_traversals\": " << total.node_traversals << ",\n";
+        out << "  \"threads\": [\n";
+        for (size_t i = 0; i < threads.size(); i++) {
+            out << "    { \"busy_time\": " << threads[i].busy_time
+                << ", \"rays\": " << stats_total_rays(threads[i]) << " }"
+                << (i + 1 < threads.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n";
+        out << "}\n";
+    }
+#endif
+
+    void stats_report(const std::vector<render_stats_t>& threads, float build_time,
+                      float wall_time)
+    {
+#if defined(ENABLE_STATS)
+        render_stats_t total = render_stats_t();
+        for (const render_stats_t& s : threads)
+            stats_merge(total, s);
+
+        uint64_t rays = stats_total_rays(total);
+        double per_ray = rays ? 1.0 / rays : 0.0;
+
+        printf("Render stats (%.3fs)\n", wall_time);
+        printf("  geometry build: %.3fs\n", build_time);
+        for (uint32_t k = 0; k < RAY_KIND_COUNT; k++)
+            printf("  %-8s rays: %lu\n", ray_kind_names[k], (unsigned long)total.rays[k]);
+        printf("  throughput: %.3f Mrays/s\n", rays / wall_time * 1e-6);
+        printf("  primitive tests per ray: %.2f\n", total.primitive_tests * per_ray);
+        printf("  node traversals per ray: %.2f\n", total.node_traversals * per_ray);
+        for (size_t i = 0; i < threads.size(); i++) {
+            printf("  thread %zu: busy %.3fs (%.1f%%), %lu rays\n", i,
+                   threads[i].busy_time, 100.f * threads[i].busy_time / wall_time,
+                   (unsigned long)stats_total_rays(threads[i]));
+        }
+
+#if defined(STATS_JSON_PATH)
+        stats_write_json(threads, total, build_time, wall_time);
+#endif
+#else
+        (void)ray_kind_names;
+        (void)threads;
+        (void)build_time;
+        (void)wall_time;
+#endif
+    }
+}
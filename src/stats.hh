@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "defines.hh"
+
+namespace RE
+{
+    typedef enum ray_kind {
+        RAY_PRIMARY, RAY_BOUNCE, RAY_SHADOW, RAY_KIND_COUNT
+    } ray_kind_e;
+
+    typedef struct render_stats {
+        uint64_t rays[RAY_KIND_COUNT];
+        uint64_t primitive_tests;
+        uint64_t node_traversals;
+        float busy_time;
+    } render_stats_t;
+
+    // Each worker only touches its own copy: no atomics on the hot path.
+    extern thread_local render_stats_t thread_stats;
+
+#if defined(ENABLE_STATS)
+    #define STATS_ADD(Field, N) (RE::thread_stats.Field += (N))
+#else
+    #define STATS_ADD(Field, N) ((void)0)
+#endif
+
+    #define STATS_INC(Field) STATS_ADD(Field, 1)
+    #define STATS_RAY(Kind) STATS_INC(rays[Kind])
+
+    uint64_t stats_total_rays(const render_stats_t& s);
+    void stats_merge(render_stats_t& dst, const render_stats_t& src);
+    // build_time is the one of the scene geometry, before the render
+    void stats_report(const std::vector<render_stats_t>& threads, float build_time,
+                      float wall_time);
+}
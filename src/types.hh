@@ -3,6 +3,9 @@
 #include <stdint.h>
 #include <vector>
 
+#include "alias_table.hh"
+#include "helpers.hh"
+#include "simd.hh"
 #include "vectors.hh"
 
 namespace RE
@@ -24,10 +27,12 @@ namespace RE
         vec3_t position;
         vec3_t rotation;
         struct material mlt;
+        uint32_t id; // In scene_t::objects, set by collect_lights()
     } object_t;
 
     typedef struct light : public object_t {
         float power;
+        uint32_t index; // In scene_t::lights, set by collect_lights()
     } light_t;
 
     // Objects
@@ -52,21 +57,264 @@ namespace RE
         vec3_t direction;
     } dir_light_t;
 
+    // A rectangle of constant y, see area_light_extent()
     typedef struct area_light : public light_t {
         vec3_t size;
-        vec3_t normal;
     } area_light_t;
 
+    // Node of the light tree built over the MDT lights. Leaves have no
+    // children (the root is never a child, so 0 marks their absence).
+    typedef struct light_node {
+        vec3_t bb_min;
+        vec3_t bb_max;
+        vec3_t intensity;
+        uint32_t representative;
+        uint32_t left, right;
+    } light_node_t;
+
+    typedef struct photon {
+        vec3_t position;
+        vec3_t power;
+        vec3_t normal; // Side of the surface the photon came from
+        uint8_t axis; // Split axis in the kd-tree
+    } photon_t;
+
+    // Left-balanced kd-tree: the children of photons[i] are photons[2i + 1]
+    // and photons[2i + 2].
+    typedef struct photon_map {
+        std::vector<photon_t> photons;
+        uint64_t emitted; // Over all the passes so far
+    } photon_map_t;
+
+    // Progressive photon mapping state of a pixel
+    typedef struct photon_pixel {
+        float radius2;
+        float count;
+        vec3_t flux;
+    } photon_pixel_t;
+
+    // Irradiance cache record: indirect irradiance at a point, its radius
+    // of validity and its gradients, one vector per color channel.
+    typedef struct ic_record {
+        vec3_t position;
+        vec3_t normal;
+        vec3_t irradiance;
+        vec3_t rot_gradient[3];
+        vec3_t trans_gradient[3];
+        float radius;
+    } ic_record_t;
+
+    typedef struct ic_node {
+        vec3_t center;
+        float half_size;
+        uint32_t children[8]; // 0 when absent: the root is never a child
+        std::vector<uint32_t> records;
+    } ic_node_t;
+
+    typedef struct irradiance_cache {
+        std::vector<ic_record_t> records;
+        std::vector<ic_node_t> nodes; // Octree, nodes[0] is the root
+    } irradiance_cache_t;
+
+    // Directional quadtree of the path guiding: each node splits its square
+    // of the cylindrical mapping of the sphere in four quadrants.
+    typedef struct dtree_node {
+        float sum[4]; // Radiance recorded in each quadrant
+        uint32_t children[4]; // 0 for a leaf quadrant: the root is never a child
+    } dtree_node_t;
+
+    typedef struct dtree {
+        std::vector<dtree_node_t> nodes;
+        uint32_t samples;
+    } dtree_t;
+
+    // Spatial binary tree, split in the middle of its box along `axis`
+    typedef struct stree_node {
+        uint32_t children[2]; // 0 for a leaf
+        uint32_t leaf; // Quadtrees of the leaf in guiding_tree_t::sampling and building
+        uint8_t axis;
+    } stree_node_t;
+
+    // Each spatial leaf samples from the distribution learned during the
+    // previous training pass while recording the next one.
+    typedef struct guiding_tree {
+        vec3_t bb_min, bb_max;
+        std::vector<stree_node_t> nodes;
+        std::vector<dtree_t> sampling;
+        std::vector<dtree_t> building;
+    } guiding_tree_t;
+
+    typedef struct guiding_record {
+        vec3_t position;
+        vec3_t normal;
+        vec3_t direction;
+        float radiance; // Incident radiance over the density of direction
+    } guiding_record_t;
+
+    // Contribution of a light subpath to the pixel it projects on
+    typedef struct splat {
+        uint32_t pixel;
+        vec3_t value;
+    } splat_t;
+
+    // Primitives of the scene, compiled per type into flat world space
+    // arrays by build_scene_geometry(). `object` indexes scene_t::objects.
+    typedef struct geometry_spheres {
+        std::vector<float> cx, cy, cz, radius2;
+        std::vector<uint32_t> object;
+    } geometry_spheres_t;
+
+    typedef struct geometry_planes {
+        std::vector<float> nx, ny, nz, offset; // dot(n, p) == offset on the plane
+        std::vector<uint32_t> object;
+    } geometry_planes_t;
+
+    // Up to SIMD_WIDTH triangles, one per lane: v[corner][axis][lane]. The
+    // lanes from count on are unused.
+    typedef struct tri_block {
+        float v[3][3][SIMD_WIDTH];
+        uint32_t count;
+    } tri_block_t;
+
+    // The mesh triangles, k in lane k % SIMD_WIDTH of block k / SIMD_WIDTH.
+    // Padding has NO_PRIMITIVE for object.
+    typedef struct geometry_triangles {
+        std::vector<tri_block_t> blocks;
+        std::vector<uint32_t> object;
+        std::vector<uint32_t> vertex; // First corner, in the arrays of the mesh
+    } geometry_triangles_t;
+
+    // Area lights: rectangles of constant y, seen from one side only
+    typedef struct geometry_quads {
+        std::vector<float> cx, cy, cz, half_x, half_z;
+        std::vector<float> ny; // Normal, -1 or 1
+        std::vector<uint32_t> object;
+    } geometry_quads_t;
+
+    typedef struct bbox {
+        vec3_t min, max;
+    } bbox_t;
+
+    // Bounding volume hierarchies, see bvh.hh. The leaves of both layouts
+    // are `count` primitives from `index`, in the order of the build.
+
+    // Inner when count is 0, its children at index and index + 1
+    typedef struct bvh_node2 {
+        bbox_t box;
+        uint32_t index;
+        uint32_t count;
+    } bvh_node2_t;
+
+    // Children of a wide node: as many as one AVX (or SSE) slab test covers
+#if SIMD_WIDTH >= 8
+    #define BVH_WIDTH 8
+#else
+    #define BVH_WIDTH 4
+#endif
+
+    // The bounds of the children, lo[axis][child], inverted in the unused
+    // slots. A child is a wide node (at index) when its count is 0.
+    typedef struct bvh_node {
+        float lo[3][BVH_WIDTH];
+        float hi[3][BVH_WIDTH];
+        uint32_t index[BVH_WIDTH];
+        uint32_t count[BVH_WIDTH];
+    } bvh_node_t;
+
+    // A wide node in a quarter of the bytes (plus a header): the bounds of
+    // the children in 8-bit steps of 2^exponent from origin, conservatively
+    // rounded, and each child packed as index << 5 | count. The slots from
+    // `children` on are unused.
+    typedef struct alignas(32) bvh_qnode {
+        float origin[3];
+        int8_t exponent[3];
+        uint8_t children;
+        uint8_t lo[3][BVH_WIDTH];
+        uint8_t hi[3][BVH_WIDTH];
+        uint32_t child[BVH_WIDTH];
+    } bvh_qnode_t;
+
+    typedef enum bvh_layout {
+        BVH_BINARY, BVH_WIDE, BVH_QUANTIZED
+    } bvh_layout_e;
+
+    typedef enum bvh_builder {
+        BVH_BUILD_SAH, BVH_BUILD_LBVH
+    } bvh_builder_e;
+
+    // The quantized layout replaces the others (see bvh_quantize())
+    typedef struct bvh {
+        bbox_t bounds;
+        std::vector<bvh_node2_t> binary; // Root first
+        std::vector<bvh_node_t> wide; // The binary one collapsed, root first
+        std::vector<bvh_qnode_t, aligned_allocator<bvh_qnode_t, 64>> quantized;
+    } bvh_t;
+
+    // A mesh hierarchy: its leaves count from the first triangle of the mesh
+    typedef struct geometry_mesh {
+        bvh_t bvh;
+        uint32_t first;
+    } geometry_mesh_t;
+
+    typedef enum instance_kind {
+        INSTANCE_SPHERE, INSTANCE_MESH, INSTANCE_QUAD
+    } instance_kind_e;
+
+    // A bounded object, index in the arrays of its kind
+    typedef struct geometry_instance {
+        instance_kind_e kind;
+        uint32_t index;
+        uint32_t object; // In scene_t::objects
+    } geometry_instance_t;
+
+    typedef struct scene_geometry {
+        geometry_spheres_t spheres;
+        geometry_planes_t planes; // Unbounded, tested apart
+        geometry_triangles_t triangles;
+        geometry_quads_t quads;
+
+        std::vector<geometry_mesh_t> meshes;
+        std::vector<geometry_instance_t> instances; // In the order of `top`
+        bvh_t top;
+        bvh_layout_e layout = BVH_WIDE; // Set before build_scene_geometry()
+        bvh_builder_e builder = BVH_BUILD_SAH; // Likewise
+        float build_time = 0.f; // Of build_scene_geometry(), in seconds
+    } scene_geometry_t;
+
     // Scene
 
+    // Thin lens camera, a pinhole when lens_radius is 0. The second half is
+    // derived from the first by camera_init().
+    typedef struct camera {
+        vec3_t position;
+        vec3_t direction;
+        vec3_t up; // Any vector in the plane of direction and the image up
+        float fov; // Horizontal, in degrees
+        float lens_radius;
+        float focus_distance;
+
+        vec3_t forward, right, true_up;
+        vec3_t corner; // Top left pixel corner, on the image plane at distance 1
+        vec3_t step_x, step_y; // One pixel on that plane
+        float plane_distance; // Of the image plane, in pixels
+        bool thin_lens;
+    } camera_t;
+
     typedef struct {
-        vec3_t camera_position;
-        vec3_t camera_direction;
+        camera_t camera;
 
         std::vector<object_t*> objects;
         std::vector<light_t*> lights;
+        scene_geometry_t geometry; // What the rays are traced against
+        alias_table_t light_distribution;
 
         std::vector<light_t> mdt_lights;
+        std::vector<light_node_t> mdt_light_tree;
+        alias_table_t mdt_light_distribution;
+
+        photon_map_t photon_map;
+        irradiance_cache_t irradiance_cache;
+        guiding_tree_t guiding;
     } scene_t;
 
     struct area {
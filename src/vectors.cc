@@ -112,6 +112,11 @@ vec3_t saturate(vec3_t c)
     return c;
 }
 
+float luminance(vec3_t c)
+{
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
 float& vec3_t::operator[](int i)
 {
     assert(i >= 0 && i < 3 && "Invalid subscript index on vector");
@@ -166,10 +171,49 @@ vec3_t rotate(vec3_t in, vec3_t angles)
     return in;
 }
 
-static inline float rand_0_1()
+// xorshift64* state, one per thread: no lock contention, and reproducible
+// as long as each unit of work reseeds it.
+static thread_local uint64_t rng_state = 0x853c49e6748fea9bULL;
+
+// When set, rand_0_1() reads its numbers from here instead
+static thread_local random_source_f rng_source = nullptr;
+static thread_local void *rng_source_data = nullptr;
+
+uint64_t random_state(uint64_t seed)
+{
+    // splitmix64, so close seeds (tile indices) give unrelated streams
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z = z ^ (z >> 31);
+    return z ? z : 0x853c49e6748fea9bULL;
+}
+
+float rand_0_1(uint64_t& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    uint64_t r = state * 0x2545f4914f6cdd1dULL;
+    return (r >> 40) * (1.0f / (1 << 24));
+}
+
+void seed_random(uint64_t seed)
 {
-    float n = (float)std::rand() / RAND_MAX;
-    return n;
+    rng_state = random_state(seed);
+}
+
+void set_random_source(random_source_f source, void *data)
+{
+    rng_source = source;
+    rng_source_data = data;
+}
+
+float rand_0_1()
+{
+    if (rng_source)
+        return rng_source(rng_source_data);
+    return rand_0_1(rng_state);
 }
 
 vec3_t get_sphere_random(void)
@@ -194,3 +238,15 @@ vec3_t get_hemisphere_random(vec3_t dir)
         d = -d;
     return d;
 }
+
+vec3_t get_cosine_hemisphere_random(vec3_t n)
+{
+    float phi = 2.0f * M_PI * rand_0_1();
+    float r2 = rand_0_1();
+    float r = sqrt(r2);
+
+    vec3_t u = normalize(cross(fabs(n.x) > 0.1f ? VECTOR_UP : VECTOR_RIGHT, n));
+    vec3_t v = cross(n, u);
+
+    return normalize(u * (cos(phi) * r) + v * (sin(phi) * r) + n * sqrt(1.0f - r2));
+}
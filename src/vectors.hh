@@ -55,7 +55,21 @@ std::string to_string(vec3_t v);
 
 vec3_t reflect(vec3_t i, vec3_t n);
 vec3_t saturate(vec3_t c);
+float luminance(vec3_t c);
 
 vec3_t rotate(vec3_t in, vec3_t angles);
+
+void seed_random(uint64_t seed);
+float rand_0_1(void);
+
+// Explicit xorshift64* streams, for code that keeps its own state
+uint64_t random_state(uint64_t seed);
+float rand_0_1(uint64_t& state);
+
+// Redirects rand_0_1() on the calling thread to source(data) until reset
+// with nullptr: the Metropolis sampler drives the integrators this way.
+typedef float (*random_source_f)(void *data);
+void set_random_source(random_source_f source, void *data);
 vec3_t get_sphere_random(void);
 vec3_t get_hemisphere_random(vec3_t dir);
+vec3_t get_cosine_hemisphere_random(vec3_t n);
@@ -0,0 +1,133 @@
+// Hierarchies over clustered primitives.
+//
+// The boxes get geometrically closer to the origin along x, where binned
+// SAH splits one of them off at a time, and a few of them differ in every
+// bit of their Morton code. Every builder must stay within BVH_MAX_DEPTH,
+// and each layout must enter every box a ray through all of them hits.
+// A hierarchy that indexes past what the quantized nodes pack is left wide.
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "bvh.hh"
+
+using namespace RE;
+
+namespace
+{
+    const uint32_t COUNT = 20000;
+
+    std::vector<bbox_t> clustered_boxes(void)
+    {
+        std::vector<bbox_t> boxes(COUNT);
+        for (uint32_t k = 0; k < COUNT; k++) {
+            float x = powf(0.999f, k);
+            float r = x * 0.0004f;
+            boxes[k] = { vec3_t(x - r, -1.f, -1.f), vec3_t(x + r, 1.f, 1.f) };
+        }
+
+        // And one box on each bit of the Morton codes, in a unit cube of
+        // centroids
+        for (uint32_t k = 0; k < 30; k++) {
+            float q = ((1 << k / 3) + 0.5f) / 1024.f;
+            vec3_t c = vec3_t(k % 3 == 2 ? q : 0.f, k % 3 == 1 ? q : 0.f, k % 3 == 0 ? q : 0.f);
+            boxes.push_back({ c - vec3_t(1e-4f), c + vec3_t(1e-4f) });
+        }
+        boxes.push_back({ vec3_t(1.f), vec3_t(1.f) });
+        return boxes;
+    }
+
+    uint32_t depth(const bvh_t& bvh, uint32_t node)
+    {
+        const bvh_node2_t& n = bvh.binary[node];
+        if (n.count)
+            return 0;
+        return 1 + std::max(depth(bvh, n.index), depth(bvh, n.index + 1));
+    }
+
+    // Primitives of the leaves the ray enters, without ever lowering t
+    uint32_t entered(const bvh_t& bvh, bvh_layout_e layout, const std::vector<bbox_t>& boxes,
+                     const std::vector<uint32_t>& order, const ray_t& r)
+    {
+        bvh_ray_t br = get_bvh_ray(r);
+        float t = 1e30f;
+        std::vector<bool> seen(boxes.size(), false);
+        bvh_traverse(bvh, layout, r, &t, [&](uint32_t index, uint32_t count) {
+            for (uint32_t k = index; k < index + count; k++) {
+                float dist;
+                if (order[k] != NO_PRIMITIVE && bvh_box_hit(boxes[order[k]], br, t, &dist))
+                    seen[order[k]] = true;
+            }
+        });
+        return std::count(seen.begin(), seen.end(), true);
+    }
+
+    // A single leaf past the primitives the packed children can index
+    bool quantize_fallback(void)
+    {
+        bvh_node_t n;
+        for (uint32_t c = 0; c < BVH_WIDTH; c++) {
+            for (uint32_t a = 0; a < 3; a++) {
+                n.lo[a][c] = c ? 1.f : 0.f;
+                n.hi[a][c] = c ? 0.f : 1.f;
+            }
+            n.index[c] = c ? 0 : 1u << 27;
+            n.count[c] = c ? 0 : 1;
+        }
+        bvh_t bvh;
+        bvh.wide.push_back(n);
+        bool quantized = bvh_quantize(bvh);
+
+        ray_t r = { vec3_t(-1.f, 0.5f, 0.5f), normalize(vec3_t(1.f, 0.01f, 0.01f)) };
+        float t = 1e30f;
+        uint32_t leaf = 0;
+        bvh_traverse(bvh, BVH_QUANTIZED, r, &t, [&](uint32_t index, uint32_t count) {
+            leaf = index;
+        });
+        return !quantized && bvh.quantized.empty() && bvh.wide.size() == 1 && leaf == 1u << 27;
+    }
+}
+
+int main()
+{
+    std::vector<bbox_t> boxes = clustered_boxes();
+    ray_t r = { vec3_t(-1.f, 0.f, 0.f), normalize(vec3_t(1.f, 0.01f, 0.01f)) };
+    bvh_ray_t br = get_bvh_ray(r);
+
+    uint32_t expected = 0;
+    for (const bbox_t& b : boxes) {
+        float dist;
+        expected += bvh_box_hit(b, br, 1e30f, &dist);
+    }
+
+    const char *names[] = { "sah", "lbvh" };
+    uint32_t failures = 0;
+    for (int builder = BVH_BUILD_SAH; builder <= BVH_BUILD_LBVH; builder++) {
+        for (uint32_t threads = 1; threads <= 4; threads *= 4) {
+            bvh_t bvh;
+            std::vector<uint32_t> order;
+            bvh_build(bvh, boxes, 4, 4, (bvh_builder_e)builder, threads, order);
+
+            uint32_t d = depth(bvh, 0);
+            uint32_t binary = entered(bvh, BVH_BINARY, boxes, order, r);
+            uint32_t wide = entered(bvh, BVH_WIDE, boxes, order, r);
+            bvh_quantize(bvh);
+            uint32_t quantized = entered(bvh, BVH_QUANTIZED, boxes, order, r);
+
+            bool ok = d <= BVH_MAX_DEPTH && binary == expected && wide == expected
+                   && quantized == expected;
+            printf("%s, %u threads: depth %u, entered %u / %u / %u of %u: %s\n",
+                   names[builder], threads, d, binary, wide, quantized, expected,
+                   ok ? "ok" : "FAIL");
+            failures += !ok;
+        }
+    }
+
+    bool fallback = quantize_fallback();
+    printf("index past the quantized nodes: %s\n", fallback ? "ok" : "FAIL");
+    failures += !fallback;
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+// Reconstruction of the film from filtered samples.
+//
+// Renders a constant radiance at one sample per pixel through the tile films,
+// which every pixel must resolve back to, and checks that a pixel left with
+// no positive weight by the negative lobes of FILTER_MITCHELL keeps the plain
+// mean of its own samples.
+
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+#include "film.hh"
+
+using namespace RE;
+
+namespace
+{
+    const uint32_t WIDTH = 24;
+    const uint32_t HEIGHT = 16;
+    const uint32_t TILE = 8;
+
+    bool near(vec3_t a, vec3_t b)
+    {
+        return fabsf(a.r - b.r) < 1e-4f && fabsf(a.g - b.g) < 1e-4f && fabsf(a.b - b.b) < 1e-4f;
+    }
+
+    uint32_t one_sample_per_pixel(pixel_filter_e f)
+    {
+        const vec3_t L = vec3_t(0.25f, 0.5f, 1.f);
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> jitter(0.f, 1.f);
+
+        std::vector<tile_film_t> tiles;
+        std::vector<vec3_t> film(WIDTH * HEIGHT);
+        for (uint32_t ty = 0; ty < HEIGHT; ty += TILE) {
+            for (uint32_t tx = 0; tx < WIDTH; tx += TILE) {
+                tile_film_t t;
+                tile_film_init(t, f, { tx, ty, TILE, TILE });
+                for (uint32_t y = ty; y < ty + TILE; y++) {
+                    for (uint32_t x = tx; x < tx + TILE; x++) {
+                        tile_film_add(t, f, x + jitter(rng), y + jitter(rng), L);
+                        film[x + y * WIDTH] = L;
+                    }
+                }
+                tiles.push_back(t);
+            }
+        }
+        film_resolve(tiles, { 0, 0, WIDTH, HEIGHT }, WIDTH, HEIGHT, film.data());
+
+        uint32_t failures = 0;
+        for (uint32_t p = 0; p < WIDTH * HEIGHT; p++)
+            failures += !near(film[p], L);
+        return failures;
+    }
+
+    uint32_t negative_weight()
+    {
+        // A lone sample 1.5 pixels to the right of the center of (4, 4)
+        const pixel_filter_e f = FILTER_MITCHELL;
+        float fx = 6.f, fy = 4.5f;
+        if (filter_weight(f, 4.5f - fx, 4.5f - fy) >= 0.f)
+            return 1;
+
+        const vec3_t box = vec3_t(0.3f);
+        std::vector<tile_film_t> tiles(1);
+        std::vector<vec3_t> film(WIDTH * HEIGHT, box);
+        tile_film_init(tiles[0], f, { 0, 0, TILE, TILE });
+        tile_film_add(tiles[0], f, fx, fy, vec3_t(1.f));
+        film_resolve(tiles, { 0, 0, TILE, TILE }, WIDTH, HEIGHT, film.data());
+
+        return !near(film[4 + 4 * WIDTH], box) + !near(film[5 + 4 * WIDTH], vec3_t(1.f));
+    }
+}
+
+int main()
+{
+    uint32_t failures = 0;
+
+    for (int f = FILTER_BOX; f <= FILTER_MITCHELL; f++) {
+        uint32_t n = one_sample_per_pixel((pixel_filter_e)f);
+        printf("filter %d, 1 spp: %u pixels off\n", f, n);
+        failures += n;
+    }
+
+    uint32_t n = negative_weight();
+    printf("negative weight: %s\n", n ? "FAIL" : "ok");
+    failures += n;
+
+    return failures ? 1 : 0;
+}
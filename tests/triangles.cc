@@ -0,0 +1,52 @@
+// Watertightness of the triangle kernels.
+//
+// A fan of triangles around the origin, in the z = 0 plane, traced by rays
+// from random origins aimed at points of its shared edges: every one of
+// them must hit, with the scalar and the SIMD kernel alike.
+
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+#include "raytracing.hh"
+
+using namespace RE;
+
+namespace
+{
+    const uint32_t FAN = 48;
+    const uint32_t RAYS = 200000;
+}
+
+int main()
+{
+    geometry_triangles_t g;
+    std::vector<vec3_t> rim(FAN);
+    for (uint32_t k = 0; k < FAN; k++)
+        rim[k] = vec3_t(cosf(2.f * PI * k / FAN), sinf(2.f * PI * k / FAN), 0.f);
+    for (uint32_t k = 0; k < FAN; k++)
+        triangles_push(g, VECTOR_ZERO, rim[k], rim[(k + 1) % FAN], 0, 0);
+    triangles_pad(g);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    uint32_t misses[2] = { 0, 0 };
+
+    for (uint32_t i = 0; i < RAYS; i++) {
+        vec3_t rim_point = rim[i % FAN];
+        vec3_t target = rim_point * unit(rng);
+        ray_t r;
+        r.origin = vec3_t(unit(rng) * 4.f - 2.f, unit(rng) * 4.f - 2.f, -0.5f - unit(rng) * 4.f);
+        r.direction = normalize(target - r.origin);
+
+        float t = 1e30f;
+        vec3_t barycentric;
+        misses[0] += intersect_triangles(g, r, true, &t, &barycentric) == NO_PRIMITIVE;
+        t = 1e30f;
+        misses[1] += intersect_triangles_simd(g, r, true, &t, &barycentric) == NO_PRIMITIVE;
+    }
+
+    printf("rays through shared edges missed: %u scalar, %u simd, of %u\n",
+           misses[0], misses[1], RAYS);
+    return misses[0] || misses[1] ? 1 : 0;
+}